@@ -0,0 +1,39 @@
+#include "threadlib.hpp"
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+using namespace mini_os;
+
+int main() {
+  std::cout << "Example: per-thread arenas and memory accounting\n";
+
+  // one thread per "request": every allocation it makes comes from its own
+  // arena and is released in bulk when the thread finishes
+  for (int req = 0; req < 4; ++req) {
+    thread_create([req]{
+      // request body: larger than the arena's first chunk
+      auto* body = static_cast<char*>(thread_alloc(10000));
+      std::memset(body, 'x', 10000);
+      std::pmr::memory_resource* mr = thread_memory_resource();
+      std::pmr::vector<std::pmr::string> headers(mr);
+      for (int i = 0; i < 50; ++i) {
+        headers.emplace_back("X-Header-" + std::to_string(i) + ": a value long enough to allocate");
+        if (i % 10 == 0) thread_yield();
+      }
+      auto* scratch = static_cast<char*>(thread_alloc(256));
+      int n = std::snprintf(scratch, 256, "req %d: %zu headers, last '%s'", req, headers.size(),
+                            headers.back().c_str());
+      std::cout << "[REQ] " << std::string(scratch, n) << "\n";
+    }, "request");
+  }
+
+  // mid-run snapshot: per-thread stack, TLS, callable and arena bytes
+  thread_create([]{ runtime_dump(std::cout); }, "monitor");
+
+  thread_run();
+  std::cout << "Done. Log: schedule_log.csv\n";
+}
@@ -0,0 +1,40 @@
+#include "threadlib.hpp"
+#include <iostream>
+#include <string>
+
+using namespace mini_os;
+
+int main() {
+  std::cout << "Example: cooperative cancellation\n";
+
+  // threads serving one "client" share a token
+  CancelToken session;
+  for (int i = 0; i < 3; ++i) {
+    int tid = thread_create([i]{
+      for (int step = 0; ; ++step) {
+        if (!thread_sleep(50)) {
+          std::cout << "[W" << i << "] cancelled at step " << step << "\n";
+          return;
+        }
+        std::cout << "[W" << i << "] step " << step << "\n";
+      }
+    }, "worker" + std::to_string(i), 5);
+    session.attach(tid);
+  }
+
+  // a waiter that would otherwise block forever
+  int waiter = thread_create([]{
+    if (!thread_wait("reply")) std::cout << "[WAIT] cancelled\n";
+  }, "waiter", 5);
+
+  // the client disconnects: reclaim everything serving it
+  thread_create([&]{
+    thread_sleep(120);
+    std::cout << "[CLIENT] disconnected\n";
+    session.cancel();
+    thread_cancel(waiter);
+  }, "client", 7);
+
+  thread_run();
+  std::cout << "Done. Log: schedule_log.csv\n";
+}
@@ -0,0 +1,44 @@
+#include "threadlib_task.hpp"
+#include <iostream>
+
+using namespace mini_os;
+
+// child task: awaited by its parent, returns a value
+Task<int> square_later(int x) {
+  co_await task_sleep(10);
+  co_return x * x;
+}
+
+Task<void> producer(Channel<int>& ch) {
+  for (int i = 1; i <= 5; ++i) {
+    int v = co_await square_later(i);
+    std::cout << "[TASK] send " << v << "\n";
+    co_await ch.async_send(v);
+  }
+  ch.close();
+}
+
+Task<void> fan_out_child(int& done) {
+  co_await task_yield();
+  ++done;
+}
+
+int main() {
+  std::cout << "Example: coroutine tasks + green threads\n";
+  Channel<int> ch;
+
+  // stackless producer, stackful consumer, same scheduler and channel
+  task_spawn(producer(ch), "producer", 5);
+  thread_create([&]{
+    while (auto v = ch.recv()) std::cout << "[THREAD] recv " << *v << "\n";
+    std::cout << "[THREAD] channel closed\n";
+  }, "consumer", 5);
+
+  // fan-out: 10k tasks cost their frames, not 10k stacks
+  int done = 0;
+  for (int i = 0; i < 10000; ++i) task_spawn(fan_out_child(done), "child", 1);
+
+  thread_run();
+  std::cout << "fan-out tasks finished: " << done << "\n";
+  std::cout << "Done. Log: schedule_log.csv\n";
+}
@@ -0,0 +1,61 @@
+#include "threadlib.hpp"
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <string>
+
+using namespace mini_os;
+
+// Last-in first-out: the most recently readied thread runs next. Checked
+// against SchedulingPolicy at compile time; the scheduler calls it through one
+// function pointer per hook.
+struct LifoPolicy {
+  std::deque<int> q;
+  void        enqueue(const SchedThread& t) { q.push_back(t.tid); }
+  int         pop() { if (q.empty()) return -1; int t = q.back(); q.pop_back(); return t; }
+  bool        empty() const { return q.empty(); }
+  std::size_t size() const { return q.size(); }
+  int         quantum(const SchedThread& t) { return 2 * t.priority; }
+};
+static_assert(SchedulingPolicy<LifoPolicy>);
+
+// The runtime-polymorphic form: any PolicyBase, e.g. one picked from config.
+struct FifoPolicy : PolicyBase {
+  std::deque<int> q;
+  void        enqueue(const SchedThread& t) override { q.push_back(t.tid); }
+  int         pop() override { if (q.empty()) return -1; int t = q.front(); q.pop_front(); return t; }
+  bool        empty() const override { return q.empty(); }
+  std::size_t size() const override { return q.size(); }
+};
+
+static void spawn_workers(const char* tag) {
+  for (int i = 0; i < 3; ++i) {
+    thread_spawn([tag, i] {
+      for (int k = 0; k < 3; ++k) {
+        std::cout << "[" << tag << "] worker " << i << " step " << k << "\n";
+        thread_yield();
+      }
+    }, "worker", 1 + i);
+  }
+}
+
+int main() {
+  std::cout << "Example: LifoPolicy\n";
+  {
+    LifoPolicy lifo;
+    Runtime rt("custom_policy_lifo.csv");
+    Runtime::Scope scope(rt);
+    set_policy(lifo);
+    spawn_workers("lifo");
+    thread_run();
+  }
+
+  std::cout << "Example: a PolicyBase behind a pointer\n";
+  std::unique_ptr<PolicyBase> policy = std::make_unique<FifoPolicy>();
+  Runtime rt("custom_policy_fifo.csv");
+  Runtime::Scope scope(rt);
+  set_policy(*policy);
+  spawn_workers("fifo");
+  thread_run();
+  return 0;
+}
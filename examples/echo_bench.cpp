@@ -0,0 +1,106 @@
+#include "threadlib.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <sys/resource.h>
+#include <unistd.h>
+
+using namespace mini_os;
+
+// Thread-per-connection echo server on loopback: one green thread per accepted
+// connection and one per client, all on a single OS thread.
+// usage: echo_bench [connections=10000] [round_trips=10] [tcp|unix]
+
+static bool read_full(int fd, char* buf, size_t len) {
+  size_t got = 0;
+  while (got < len) {
+    auto n = sock_read(fd, buf + got, len - got);
+    if (n <= 0) return false;
+    got += (size_t)n;
+  }
+  return true;
+}
+
+static bool write_full(int fd, const char* buf, size_t len) {
+  size_t put = 0;
+  while (put < len) {
+    auto n = sock_write(fd, buf + put, len - put);
+    if (n <= 0) return false;
+    put += (size_t)n;
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  int  conns    = argc > 1 ? std::atoi(argv[1]) : 10000;
+  int  trips    = argc > 2 ? std::atoi(argv[2]) : 10;
+  bool use_unix = argc > 3 && std::strcmp(argv[3], "unix") == 0;
+  const char* path = "/tmp/threadlib_echo.sock";
+
+  // two fds per connection (client + server side)
+  rlimit rl{};
+  getrlimit(RLIMIT_NOFILE, &rl);
+  rl.rlim_cur = rl.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &rl);
+  int max_conns = (int)((rl.rlim_cur - 64) / 2);
+  if (conns > max_conns) {
+    std::cout << "fd limit " << rl.rlim_cur << ": capping at " << max_conns << " connections\n";
+    conns = max_conns;
+  }
+
+  int lfd = use_unix ? sock_listen_unix(path, 4096) : sock_listen_tcp("127.0.0.1", 0, 4096);
+  if (lfd < 0) { perror("listen"); return 1; }
+  int port = use_unix ? 0 : sock_local_port(lfd);
+  std::cout << "Example: echo benchmark, " << conns << " connections x " << trips
+            << " round trips over " << (use_unix ? "unix" : "tcp") << "\n";
+
+  int served = 0, completed = 0, failed = 0;
+
+  // acceptor: one echo thread per connection
+  thread_create([&]{
+    for (int i = 0; i < conns; ++i) {
+      int fd = sock_accept(lfd);
+      if (fd < 0) { perror("accept"); break; }
+      thread_spawn([fd, &served]{
+        char buf[256];
+        for (;;) {
+          auto n = sock_read(fd, buf, sizeof(buf));
+          if (n <= 0 || !write_full(fd, buf, (size_t)n)) break;
+        }
+        close(fd);
+        ++served;
+      }, "echo", 5);
+    }
+  }, "acceptor", 5);
+
+  // spawner: clients in batches so the accept backlog never overflows
+  thread_create([&]{
+    for (int base = 0; base < conns; base += 512) {
+      thread_create_n(std::min(512, conns - base), [&](int){
+        int fd = use_unix ? sock_connect_unix(path) : sock_connect_tcp("127.0.0.1", port);
+        if (fd < 0) { ++failed; return; }
+        char out[64], in[64];
+        std::memset(out, 'x', sizeof(out));
+        bool ok = true;
+        for (int t = 0; t < trips && ok; ++t)
+          ok = write_full(fd, out, sizeof(out)) && read_full(fd, in, sizeof(in));
+        close(fd);
+        ok ? ++completed : ++failed;
+      }, "client", 5);
+      thread_yield();
+    }
+  }, "spawner", 5);
+
+  auto t0 = std::chrono::steady_clock::now();
+  thread_run();
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+  close(lfd);
+  if (use_unix) unlink(path);
+  std::cout << "clients ok: " << completed << ", failed: " << failed << ", served: " << served << "\n"
+            << "time: " << secs << " s, " << (long long)(completed * (double)trips / secs)
+            << " round trips/s\n";
+}
@@ -0,0 +1,43 @@
+#include "threadlib.hpp"
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+using namespace mini_os;
+
+int main() {
+  std::cout << "Example: TaskGroup + parallel_for\n";
+
+  thread_create([]{
+    // data-parallel loop: 64 elements, 8 per green thread
+    std::vector<long> squares(64);
+    parallel_for(0, (int)squares.size(), 8, [&](int i) {
+      squares[i] = (long)i * i;
+      thread_work(1);
+    });
+    long sum = 0;
+    for (long v : squares) sum += v;
+    std::cout << "[MAIN] sum of squares = " << sum << "\n";
+
+    // fork-join with an error: wait() rethrows the first exception
+    TaskGroup g;
+    for (int i = 0; i < 4; ++i) {
+      g.spawn([i]{
+        if (!thread_sleep(10 * (i + 1))) {
+          std::cout << "[CHILD " << i << "] cancelled\n";
+          return;
+        }
+        if (i == 2) throw std::runtime_error("child 2 failed");
+        std::cout << "[CHILD " << i << "] ok\n";
+      }, "child", 5);
+    }
+    try {
+      g.wait();
+    } catch (const std::exception& e) {
+      std::cout << "[MAIN] caught: " << e.what() << "\n";
+    }
+  }, "main", 5);
+
+  thread_run();
+  std::cout << "Done. Log: schedule_log.csv\n";
+}
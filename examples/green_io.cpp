@@ -0,0 +1,56 @@
+#include "threadlib.hpp"
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+using namespace mini_os;
+
+int main() {
+  std::cout << "Example: green-thread I/O (io_uring on Linux)\n";
+
+  constexpr int N = 3;
+  int pipes[N][2];
+  for (auto& p : pipes) {
+    if (pipe(p) != 0) { perror("pipe"); return 1; }
+  }
+
+  // readers park inside green_read until their pipe has data
+  for (int i = 0; i < N; ++i) {
+    thread_create([i, fd = pipes[i][0]]{
+      char buf[64];
+      for (;;) {
+        auto n = green_read(fd, buf, sizeof(buf) - 1);
+        if (n <= 0) break;
+        buf[n] = '\0';
+        std::cout << "[R" << i << "] got: " << buf << "\n";
+      }
+      std::cout << "[R" << i << "] eof\n";
+    }, "reader" + std::to_string(i), 5);
+  }
+
+  // writer feeds the pipes slowly, then closes them
+  thread_create([&]{
+    for (int round = 0; round < 3; ++round) {
+      thread_sleep(100);
+      for (int i = 0; i < N; ++i) {
+        std::string msg = "round " + std::to_string(round);
+        green_write(pipes[i][1], msg.data(), msg.size());
+      }
+    }
+    for (auto& p : pipes) close(p[1]);
+  }, "writer", 5);
+
+  // keeps running while the readers are blocked
+  thread_create([]{
+    for (int i = 0; i < 6; ++i) {
+      std::cout << "[CPU] spin " << i << "\n";
+      for (volatile int k = 0; k < 400000; k++);
+      thread_work(4);
+      thread_yield();
+    }
+  }, "cpu", 3);
+
+  thread_run();
+  for (auto& p : pipes) close(p[0]);
+  std::cout << "Done. Log: schedule_log.csv\n";
+}
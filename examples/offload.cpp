@@ -0,0 +1,35 @@
+#include "threadlib.hpp"
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+
+using namespace mini_os;
+
+int main() {
+  std::cout << "Example: offloading blocking calls\n";
+
+  // blocking call (stand-in for fsync) runs on a helper thread;
+  // thread_spawn accepts the move-only capture
+  auto path = std::make_unique<std::string>("data.log");
+  thread_spawn([path = std::move(path)]{
+    std::cout << "[SYNC] flushing " << *path << "...\n";
+    int rc = thread_offload([]{
+      std::this_thread::sleep_for(std::chrono::milliseconds(300));
+      return 0;
+    });
+    std::cout << "[SYNC] flushed, rc=" << rc << "\n";
+  }, "sync", 5);
+
+  // keeps ticking while the flush is in progress
+  thread_create([]{
+    for (int i = 0; i < 5; ++i) {
+      std::cout << "[TICK] " << i << "\n";
+      thread_sleep(50);
+    }
+  }, "ticker", 5);
+
+  thread_run();
+  std::cout << "Done. Log: schedule_log.csv\n";
+}
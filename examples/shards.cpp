@@ -0,0 +1,54 @@
+#include "threadlib.hpp"
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace mini_os;
+
+// One Runtime per OS thread: each shard schedules its own green threads and
+// resources with no shared scheduler state. The main thread releases every
+// shard through Runtime::notify, the one call that crosses OS threads.
+int main() {
+  const int shards = (int)std::clamp(std::thread::hardware_concurrency(), 2u, 4u);
+  std::cout << "Example: " << shards << " runtimes on " << shards << " OS threads\n";
+
+  std::vector<Runtime*> runtimes(shards);
+  std::atomic<int>  parked{0};
+  std::atomic<long> total{0};
+  std::vector<std::thread> os_threads;
+
+  for (int s = 0; s < shards; ++s) {
+    os_threads.emplace_back([&, s] {
+      Runtime rt("shard" + std::to_string(s) + ".csv");
+      runtimes[s] = &rt;
+      Runtime::Scope scope(rt);
+
+      // the same resource names in every shard never collide
+      long rounds = 0;
+      thread_spawn([&] {
+        for (int i = 0; i < 1000; ++i) { thread_wait("ping"); thread_signal("pong"); }
+      }, "pong"); // first, so it is waiting before the first ping
+      thread_spawn([&] {
+        for (int i = 0; i < 1000; ++i) { thread_signal("ping"); thread_wait("pong"); ++rounds; }
+      }, "ping");
+      thread_spawn([&] {
+        parked.fetch_add(1); // the notify is applied only after we are queued
+        thread_wait("go");
+        std::cout << "[SHARD " << s << "] released after " << rounds << " rounds\n";
+      }, "waiter");
+
+      thread_run();
+      total += rounds;
+    });
+  }
+
+  while (parked.load() < shards) std::this_thread::yield();
+  for (Runtime* rt : runtimes) rt->notify("go");
+  for (auto& t : os_threads) t.join();
+
+  std::cout << "ping-pong rounds across shards: " << total.load() << "\n";
+  return 0;
+}
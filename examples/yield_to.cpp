@@ -0,0 +1,62 @@
+#include "threadlib.hpp"
+#include <deque>
+#include <iostream>
+
+using namespace mini_os;
+
+// Directed yields under each built-in policy: the target leaves the middle of
+// its run queue, and everything still queued runs afterwards.
+static void run_with(SchedPolicy policy, const char* name) {
+  std::cout << "-- " << name << "\n";
+  Runtime rt(""); // no log
+  Runtime::Scope scope(rt);
+  set_policy(policy);
+
+  // A hands its turn to C while B and C are both queued behind it
+  int c = -1;
+  thread_create([&]{
+    thread_work(1);
+    std::cout << "[A] yield_to C\n";
+    thread_yield_to(c);
+    std::cout << "[A] back\n";
+  }, "A", 5);
+  thread_create([]{
+    for (int i = 0; i < 3; ++i) { thread_work(1); thread_yield(); }
+    std::cout << "[B] done\n";
+  }, "B", 5);
+  c = thread_create([]{
+    std::cout << "[C] running\n";
+    thread_yield();
+    std::cout << "[C] done\n";
+  }, "C", 5);
+
+  // producer hands each item to the consumer, which yields after taking it
+  std::deque<int> items;
+  const int n = 20;
+  thread_create([&]{
+    for (int got = 0; got < n; ) {
+      while (items.empty()) thread_wait("item");
+      got += (int)items.size();
+      items.clear();
+      thread_yield();
+    }
+    std::cout << "[CONSUMER] got " << n << " items\n";
+  }, "consumer", 5);
+  thread_create([&]{
+    for (int i = 0; i < n; ++i) {
+      items.push_back(i);
+      thread_signal("item", true);
+      thread_work(1);
+    }
+  }, "producer", 5);
+
+  thread_run();
+}
+
+int main() {
+  std::cout << "Example: thread_yield_to and handoff signals\n";
+  run_with(SchedPolicy::RoundRobin, "round robin");
+  run_with(SchedPolicy::Priority, "priority");
+  run_with(SchedPolicy::MLFQ, "mlfq");
+  std::cout << "Done.\n";
+}
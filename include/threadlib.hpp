@@ -1,51 +1,586 @@
 #ifndef THREADLIB_HPP
 #define THREADLIB_HPP
 
+#include <concepts>
 #include <functional>
+#include <iosfwd>
 #include <string>
 #include <cstdint>
 #include <optional>
+#include <cstddef>
+#include <exception>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+#if !defined(_WIN32)
+  #include <sys/socket.h>
+#endif
 
 namespace mini_os {
 
 using ThreadFunc = std::function<void()>;
 
-// Scheduler policies
-enum class SchedPolicy { RoundRobin, Priority, MLFQ };
+// Scheduler policies. Custom is a user policy object (see SchedulingPolicy).
+enum class SchedPolicy { RoundRobin, Priority, MLFQ, Custom };
 
 // Create a thread with name and priority (1..10)
 int  thread_create(const ThreadFunc& func, const std::string& name = "task", int priority = 1);
 
+// Same, for any callable (including move-only lambdas). The callable is moved
+// into storage at the top of the thread's stack: no std::function, no extra
+// allocation, and it is destroyed as soon as the thread finishes.
+template <class F>
+int  thread_spawn(F&& fn, const std::string& name = "task", int priority = 1);
+
+// Create count threads running fn(index), index = 0..count-1, sharing one
+// copy of fn. Records and stacks come from one allocation each and the batch
+// is queued in one insertion. Returns the first tid; tids are consecutive.
+template <class F>
+int  thread_create_n(int count, F&& fn, const std::string& name = "task", int priority = 1);
+
 // Start the scheduler loop; returns when all threads finish
 void thread_run();
 
 // Cooperative yield
 void thread_yield();
 
-// Sleep for N milliseconds
-void thread_sleep(int ms);
+// Directed yield: switch straight into thread tid (READY or not yet started),
+// ahead of the run queue and without passing through the scheduler; the
+// caller is re-queued as by thread_yield. Returns false, without yielding, if
+// tid cannot run now or the caller is not a green thread.
+bool thread_yield_to(int tid);
+
+// Sleep for N milliseconds. Returns false if the thread was cancelled.
+bool thread_sleep(int ms);
+
+// Simple wait/signal on a named resource. thread_wait returns false if the
+// thread was cancelled instead of signalled. With handoff, the signalling
+// thread yields to the woken waiter at once (thread_yield_to) — for
+// producer/consumer pairs; from a task, the waiter runs when the task suspends.
+bool thread_wait(const std::string& resource);
+void thread_signal(const std::string& resource, bool handoff = false);
+
+// Cooperative cancellation. thread_cancel marks a thread cancelled and wakes
+// it if it is sleeping, waiting, blocked in green/sock I/O (which then fail
+// with ECANCELED) or parked on a Channel. Cancellation is sticky: every later
+// blocking call of that thread returns at once. A running thread_offload job
+// is not interrupted; the thread sees the flag when it returns.
+void thread_cancel(int tid);
+bool thread_cancelled(); // for the running thread
+
+// thread_signal for use from other OS threads (e.g. a callback on a helper
+// thread). Thread-safe; the signal is applied on the scheduler's next pass and
+// wakes it if idle. Like thread_signal, it is dropped if nobody is waiting.
+void thread_notify(const std::string& resource);
+
+// Run a blocking call (fsync, a large read, a library call) on a helper OS
+// thread while the calling green thread is parked BLOCKED; other green threads
+// keep running. Returns fn's result and rethrows its exception. fn must not
+// call back into the scheduler. Outside a green thread fn runs inline.
+template <class F>
+std::invoke_result_t<F&> thread_offload(F&& fn);
 
-// Simple wait/signal on a named resource
-void thread_wait(const std::string& resource);
-void thread_signal(const std::string& resource);
+// Maximum number of helper threads used by thread_offload (default 4).
+void offload_set_threads(int n);
+
+// What the scheduler does when nothing is runnable: busy-poll for spin_us,
+// then sched_yield() for yield_us, then block in the kernel until a sleeper
+// is due, I/O completes or thread_notify arrives. Spinning trades a core for
+// wakeup latency; the default (0, 0) parks at once, for dense hosts.
+void idle_set_strategy(int spin_us, int yield_us);
+
+// Idle periods of the current runtime, by the phase that ended them.
+struct IdleStats {
+  std::uint64_t spin  = 0; // work showed up while spinning
+  std::uint64_t yield = 0; // ... while yielding
+  std::uint64_t park  = 0; // blocked in the kernel
+};
+IdleStats idle_stats();
+
+// Memory held by the current runtime, in bytes, to see which kinds of thread
+// drive RSS as thread counts grow. Per thread (and task) not yet finished:
+struct ThreadMemory {
+  int         tid = -1;
+  std::string name;
+  std::size_t stack_reserved = 0; // 0 for tasks and Win32 fibers (OS-owned)
+  std::size_t stack_touched  = 0; // resident stack pages (Linux mincore), else 0
+  std::size_t tls      = 0;       // string-keyed entries and GreenLocal values
+  std::size_t callable = 0;       // spawned callable's capture, until it returns
+  std::size_t arena    = 0;       // thread_alloc chunks
+};
+// Runtime totals. Stacks are kept until the runtime is destroyed, so stacks
+// and stacks_touched include finished threads; callables counts only captures
+// on the heap (the rest live inside stacks).
+struct MemoryStats {
+  std::vector<ThreadMemory> threads;
+  std::size_t records = 0;        // thread records and per-tid arrays
+  std::size_t stacks = 0;
+  std::size_t stacks_touched = 0;
+  std::size_t tls = 0;            // including the main context's
+  std::size_t callables = 0;
+  std::size_t arenas = 0;         // including the main context's
+  std::size_t run_queues = 0;     // scheduler queue storage
+  std::size_t wait_queues = 0;    // thread_wait resources and their queues
+  std::size_t log_written = 0;    // bytes written to the schedule log (on disk)
+  std::size_t total() const {
+    return records + stacks + tls + callables + arenas + run_queues + wait_queues;
+  }
+};
+MemoryStats memory_stats();
+
+// Human-readable snapshot of the current runtime: policy, every thread not
+// yet finished (state, priority, memory as in ThreadMemory) and the totals.
+void runtime_dump(std::ostream& out);
 
 // Simulate work units. If the thread exceeds its quantum budget, it auto-yields.
 // Return value: remaining budget after this call.
 int  thread_work(int units = 1);
 
-// Set scheduler policy directly (overrides env var)
+#if !defined(_WIN32)
+// Green-thread I/O. On Linux the calling thread submits to io_uring and is
+// parked until the scheduler reaps the completion; elsewhere (or outside a
+// green thread) the plain syscall runs. Same contract as read/write/accept:
+// -1 with errno set on failure. offset < 0 uses the file position.
+std::int64_t green_read(int fd, void* buf, std::size_t len, std::int64_t offset = -1);
+std::int64_t green_write(int fd, const void* buf, std::size_t len, std::int64_t offset = -1);
+int          green_accept(int fd, sockaddr* addr = nullptr, socklen_t* addrlen = nullptr);
+
+// Non-blocking socket wrappers (TCP and Unix-domain). Each call is tried
+// without blocking; on EAGAIN the green thread parks until the socket polls
+// ready. Listening/connected fds returned here are already non-blocking; use
+// sock_set_nonblocking() for sockets created elsewhere before sock_accept.
+// Errors: -1 with errno set.
+int          sock_listen_tcp(const char* host, int port, int backlog = 1024); // port 0: ephemeral
+int          sock_listen_unix(const char* path, int backlog = 1024);
+int          sock_connect_tcp(const char* host, int port);
+int          sock_connect_unix(const char* path);
+int          sock_accept(int fd, sockaddr* addr = nullptr, socklen_t* addrlen = nullptr);
+int          sock_connect(int fd, const sockaddr* addr, socklen_t addrlen);
+std::int64_t sock_read(int fd, void* buf, std::size_t len);
+std::int64_t sock_write(int fd, const void* buf, std::size_t len);
+int          sock_set_nonblocking(int fd);
+int          sock_local_port(int fd); // bound TCP port, e.g. after listening on port 0
+#endif
+
+// An independent scheduler: its own threads, run queues, resources, TLS,
+// io_uring and log. The free functions in this header act on the calling OS
+// thread's current runtime; an OS thread that never selected one uses the
+// process-wide default runtime (log: schedule_log.csv). Run one Runtime per OS
+// thread (e.g. one per core) for shards that share no scheduler state:
+//
+//   std::thread([] { Runtime rt("shard1.csv"); Runtime::Scope s(rt);
+//                    thread_spawn(...); thread_run(); });
+//
+// A runtime must only be used by one OS thread at a time; notify() is the
+// exception. Thread ids are per runtime. TLS slot keys and GreenLocal<T>
+// variables are process-wide and valid in every runtime.
+
+class Runtime {
+ public:
+  explicit Runtime(const std::string& log_path = "schedule_log.csv"); // "": no log
+  ~Runtime();
+  Runtime(const Runtime&) = delete;
+  Runtime& operator=(const Runtime&) = delete;
+
+  struct Impl; // opaque
+
+  // Makes the runtime current on this OS thread until the scope ends.
+  class Scope {
+   public:
+    explicit Scope(Runtime& rt);
+    ~Scope();
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+   private:
+    Impl* prev_;
+  };
+
+  // thread_run() with this runtime current.
+  void run();
+
+  // thread_notify() aimed at this runtime; safe from any OS thread.
+  void notify(const std::string& resource);
+
+ private:
+  std::unique_ptr<Impl> impl_;
+};
+
+// Set scheduler policy directly (overrides env var). Also safe while
+// thread_run is active: queued threads move to the new policy's queues.
+// SchedPolicy::Custom is ignored (the active policy stays); install a policy
+// object with set_policy(obj) instead.
 void set_policy(SchedPolicy p);
 
+// ---- User scheduling policies ----
+//
+// A policy owns the run queue of READY threads. Required:
+//   void   enqueue(const SchedThread& t); // t became READY
+//   int    pop();                          // next tid to run, -1 if none
+//   bool   empty() const;
+//   size_t size() const;
+// Optional hooks, called when present:
+//   void on_quantum_expired(const SchedThread& t); // before t is re-queued
+//   void on_block(const SchedThread& t);   // t sleeps, waits or parks
+//   int  quantum(const SchedThread& t);    // thread_work budget when dispatched
+//   void tick();                           // once per scheduling pass
+// Policies run on the runtime's OS thread and must not call thread_* blocking
+// functions.
+struct SchedThread {
+  int tid;
+  int priority;     // base priority, 1..10
+  int dyn_priority; // Priority policy's level when last queued or dispatched
+};
+
+template <class P>
+concept SchedulingPolicy = requires(P& p, const P& cp, const SchedThread& t) {
+  { p.enqueue(t) } -> std::same_as<void>;
+  { p.pop() } -> std::convertible_to<int>;
+  { cp.empty() } -> std::convertible_to<bool>;
+  { cp.size() } -> std::convertible_to<std::size_t>;
+};
+
+// Runtime-polymorphic policy, for choosing one at run time (from config, say).
+// Each hook then costs two indirect calls: the ops table, then the vtable.
+class PolicyBase {
+ public:
+  virtual ~PolicyBase() = default;
+  virtual void        enqueue(const SchedThread& t) = 0;
+  virtual int         pop() = 0;
+  virtual bool        empty() const = 0;
+  virtual std::size_t size() const = 0;
+  virtual void on_quantum_expired(const SchedThread&) {}
+  virtual void on_block(const SchedThread&) {}
+  virtual int  quantum(const SchedThread&) { return 8; }
+  virtual void tick() {}
+};
+
+// Install policy (not copied; it must outlive its use) on the current
+// runtime, live like set_policy. The scheduler reaches P's members through a
+// per-P table of function pointers (missing optional hooks are skipped at
+// compile time): one indirect call per hook, about the cost of a virtual call.
+template <SchedulingPolicy P>
+void set_policy(P& policy);
+
 // Thread-local storage (simple key/value integers or pointer-sized values)
 void tls_set(const std::string& key, std::intptr_t value);
 std::optional<std::intptr_t> tls_get(const std::string& key);
 
+// Slot TLS for hot paths: register a name once (same name, same slot; -1 when
+// all TLS_SLOTS are taken), then access is an index into an array stored in
+// the thread record — no hashing, no allocation.
+constexpr int TLS_SLOTS = 16;
+int  tls_key_create(const std::string& name);
+void tls_slot_set(int slot, std::intptr_t value);
+std::optional<std::intptr_t> tls_slot_get(int slot);
+
+// Typed per-green-thread variable: each thread sees its own T, default-
+// constructed on first access and destroyed when that thread finishes (outside
+// green threads: one main-context value, destroyed at exit).
+template <class T>
+class GreenLocal;
+
+// Per-thread arena: bump allocation from chunks owned by the calling green
+// thread or task, all released at once when it finishes; there is no
+// individual free. Meant for request-scoped threads whose allocations die
+// together. Outside green threads the runtime owns the arena. Memory must
+// not outlive the thread that allocated it.
+void* thread_alloc(std::size_t size, std::size_t align = alignof(std::max_align_t));
+
+// The calling thread's arena as a std::pmr::memory_resource (deallocate is a
+// no-op), for pmr containers: std::pmr::vector<int> v(thread_memory_resource()).
+std::pmr::memory_resource* thread_memory_resource();
+
+// Priority policy: a READY thread gains one dynamic priority level (up to 10)
+// per interval it waits (default 100 ms) and spends one per dispatch, never
+// dropping below its base priority, so low priorities cannot starve.
+void prio_set_aging_interval_ms(int ms);
+
 // Configure MLFQ parameters
-void mlfq_set_levels(int levels);              // number of queues (default 3)
+void mlfq_set_levels(int levels);              // number of queues (default 3), live too
 void mlfq_set_quantum_by_level(int level, int quantum_units); // e.g., {8,4,2}
+// Total work units a thread may use at a level, across all its runs there,
+// before it is demoted (default: one quantum). Yielding, sleeping or waiting
+// neither resets it nor promotes the thread; only aging does.
+void mlfq_set_allotment_by_level(int level, int units);
+// Self-tuning: every period, measure the p99 wakeup latency (sleep deadline,
+// signal or I/O completion until the thread runs) and adjust the quanta, the
+// aging interval and the number of levels: shrink them while p99 is above
+// target, grow them (fewer switches for CPU-bound threads) while it is below
+// half of it. Each adjustment is logged as a "tune" event. 0 turns it off.
+void mlfq_autotune(int target_p99_us, int period_ms = 100);
+
+// Aging: every interval (default 500 ms) all threads are boosted back to the
+// top level, so demoted threads wait at most one interval.
 void mlfq_enable_aging(bool enable);
 void mlfq_set_aging_interval_ms(int ms);
 
+namespace detail {
+void offload_run(std::function<void()> job);
+
+int   green_local_key();
+void* green_local_find(int key);
+void  green_local_store(int key, void* obj, void (*dtor)(void*), std::size_t size);
+
+// Primitive park/unpark by tid, for synchronisation types built in headers.
+int  current_tid();
+// Park the running green thread BLOCKED until wake(tid). Returns false if it
+// was cancelled (at once, if already cancelled); an uncancellable park ignores
+// thread_cancel. Outside a green thread it is a fatal error.
+bool block_current(bool cancellable = true);
+void wake(int tid);        // make a BLOCKED thread READY
+
+// A policy object behind functions instantiated for its type; hooks it lacks
+// are null.
+struct PolicyOps {
+  void        (*enqueue)(void*, const SchedThread&);
+  int         (*pop)(void*);
+  bool        (*empty)(const void*);
+  std::size_t (*size)(const void*);
+  void        (*on_quantum_expired)(void*, const SchedThread&);
+  void        (*on_block)(void*, const SchedThread&);
+  int         (*quantum)(void*, const SchedThread&);
+  void        (*tick)(void*);
+};
+
+// Makes the object the current runtime's policy (see set_policy).
+void install_policy(void* policy, const PolicyOps& ops);
+
+template <class P>
+inline constexpr PolicyOps policy_ops = {
+  [](void* p, const SchedThread& t) { static_cast<P*>(p)->enqueue(t); },
+  [](void* p) -> int { return static_cast<P*>(p)->pop(); },
+  [](const void* p) -> bool { return static_cast<const P*>(p)->empty(); },
+  [](const void* p) -> std::size_t { return static_cast<const P*>(p)->size(); },
+  [] {
+    if constexpr (requires(P& p, const SchedThread& t) { p.on_quantum_expired(t); })
+      return +[](void* p, const SchedThread& t) { static_cast<P*>(p)->on_quantum_expired(t); };
+    else return static_cast<void (*)(void*, const SchedThread&)>(nullptr);
+  }(),
+  [] {
+    if constexpr (requires(P& p, const SchedThread& t) { p.on_block(t); })
+      return +[](void* p, const SchedThread& t) { static_cast<P*>(p)->on_block(t); };
+    else return static_cast<void (*)(void*, const SchedThread&)>(nullptr);
+  }(),
+  [] {
+    if constexpr (requires(P& p, const SchedThread& t) { { p.quantum(t) } -> std::convertible_to<int>; })
+      return +[](void* p, const SchedThread& t) -> int { return static_cast<P*>(p)->quantum(t); };
+    else return static_cast<int (*)(void*, const SchedThread&)>(nullptr);
+  }(),
+  [] {
+    if constexpr (requires(P& p) { p.tick(); })
+      return +[](void* p) { static_cast<P*>(p)->tick(); };
+    else return static_cast<void (*)(void*)>(nullptr);
+  }(),
+};
+
+struct SpawnSlot { int tid; void* storage; };
+SpawnSlot thread_reserve(std::size_t size, std::size_t align, const std::string& name, int priority);
+void      thread_commit(int tid, void (*invoke)(void*), void (*destroy)(void*));
+void      thread_abandon(int tid);
+int       thread_reserve_n(int count, std::size_t size, std::size_t align, const std::string& name, int priority);
+void*     thread_storage(int tid);
+void      thread_commit_n(int first, int count, void (*invoke)(void*), void (*destroy)(void*));
+} // namespace detail
+
+template <class F>
+int thread_spawn(F&& fn, const std::string& name, int priority) {
+  using Fn = std::decay_t<F>;
+  detail::SpawnSlot slot = detail::thread_reserve(sizeof(Fn), alignof(Fn), name, priority);
+  try {
+    ::new (slot.storage) Fn(std::forward<F>(fn));
+  } catch (...) {
+    detail::thread_abandon(slot.tid);
+    throw;
+  }
+  detail::thread_commit(slot.tid,
+                        [](void* p) { (*static_cast<Fn*>(p))(); },
+                        [](void* p) { static_cast<Fn*>(p)->~Fn(); });
+  return slot.tid;
+}
+
+template <class F>
+int thread_create_n(int count, F&& fn, const std::string& name, int priority) {
+  if (count <= 0) return -1;
+  // one shared callable, released by whichever thread finishes last
+  struct Shared { std::decay_t<F> fn; int remaining; };
+  struct Arg    { Shared* shared; int index; };
+  auto* shared = new Shared{std::forward<F>(fn), count};
+  int first = detail::thread_reserve_n(count, sizeof(Arg), alignof(Arg), name, priority);
+  for (int i = 0; i < count; ++i)
+    ::new (detail::thread_storage(first + i)) Arg{shared, i};
+  detail::thread_commit_n(first, count,
+                          [](void* p) { auto* a = static_cast<Arg*>(p); a->shared->fn(a->index); },
+                          [](void* p) {
+                            auto* a = static_cast<Arg*>(p);
+                            if (--a->shared->remaining == 0) delete a->shared;
+                          });
+  return first;
+}
+
+template <class F>
+std::invoke_result_t<F&> thread_offload(F&& fn) {
+  using R = std::invoke_result_t<F&>;
+  std::exception_ptr err;
+  if constexpr (std::is_void_v<R>) {
+    detail::offload_run([&]{
+      try { fn(); } catch (...) { err = std::current_exception(); }
+    });
+    if (err) std::rethrow_exception(err);
+  } else {
+    std::optional<R> out;
+    detail::offload_run([&]{
+      try { out.emplace(fn()); } catch (...) { err = std::current_exception(); }
+    });
+    if (err) std::rethrow_exception(err);
+    return std::move(*out);
+  }
+}
+
+template <SchedulingPolicy P>
+void set_policy(P& policy) {
+  detail::install_policy(&policy, detail::policy_ops<P>);
+}
+
+template <class T>
+class GreenLocal {
+ public:
+  GreenLocal() : key_(detail::green_local_key()) {}
+  GreenLocal(const GreenLocal&) = delete;
+  GreenLocal& operator=(const GreenLocal&) = delete;
+
+  T& get() {
+    if (void* p = detail::green_local_find(key_)) return *static_cast<T*>(p);
+    T* obj = new T();
+    detail::green_local_store(key_, obj, [](void* p) { delete static_cast<T*>(p); }, sizeof(T));
+    return *obj;
+  }
+  T& operator*() { return get(); }
+  T* operator->() { return &get(); }
+
+  // Whether the running thread has constructed its value yet.
+  bool has_value() const { return detail::green_local_find(key_) != nullptr; }
+
+ private:
+  int key_;
+};
+
+// Cancels a set of threads together: attach tids, then cancel() them all.
+// Threads attached after cancel() are cancelled immediately. Copies share state.
+class CancelToken {
+ public:
+  CancelToken() : s_(std::make_shared<State>()) {}
+
+  void attach(int tid) {
+    if (s_->cancelled) thread_cancel(tid);
+    else s_->tids.push_back(tid);
+  }
+
+  void cancel() {
+    if (s_->cancelled) return;
+    s_->cancelled = true;
+    for (int tid : std::exchange(s_->tids, {})) thread_cancel(tid);
+  }
+
+  bool cancelled() const { return s_->cancelled; }
+
+ private:
+  struct State { bool cancelled = false; std::vector<int> tids; };
+  std::shared_ptr<State> s_;
+};
+
+// Fork-join scope over green threads. wait() parks the caller (no polling)
+// until every child has finished, then rethrows the first exception a child
+// threw; that first exception also cancels the remaining children. If the
+// waiter itself is cancelled, the children are cancelled and still joined.
+// From the main context (outside any green thread) wait() runs the scheduler
+// with thread_run() until all threads, children included, have finished. The
+// destructor waits too but swallows the exception.
+class TaskGroup {
+ public:
+  TaskGroup() = default;
+  TaskGroup(const TaskGroup&) = delete;
+  TaskGroup& operator=(const TaskGroup&) = delete;
+  ~TaskGroup() {
+    try { wait(); } catch (...) {}
+  }
+
+  template <class F>
+  int spawn(F&& fn, const std::string& name = "task", int priority = 1) {
+    ++pending_;
+    int tid = thread_spawn([this, fn = std::forward<F>(fn)]() mutable {
+      run([&]{ fn(); });
+    }, name, priority);
+    token_.attach(tid);
+    return tid;
+  }
+
+  // count children running fn(index), created with thread_create_n.
+  template <class F>
+  int spawn_n(int count, F&& fn, const std::string& name = "task", int priority = 1) {
+    if (count <= 0) return -1;
+    pending_ += count;
+    int first = thread_create_n(count, [this, fn = std::forward<F>(fn)](int i) mutable {
+      run([&]{ fn(i); });
+    }, name, priority);
+    for (int i = 0; i < count; ++i) token_.attach(first + i);
+    return first;
+  }
+
+  void wait() {
+    if (pending_ > 0 && detail::current_tid() < 0) thread_run(); // main context
+    bool cancellable = true;
+    while (pending_ > 0) {
+      waiter_ = detail::current_tid();
+      if (!detail::block_current(cancellable)) {
+        cancel();
+        cancellable = false;
+      }
+    }
+    waiter_ = -1;
+    if (error_) std::rethrow_exception(std::exchange(error_, nullptr));
+  }
+
+  void cancel() { token_.cancel(); }
+  int  pending() const { return pending_; }
+
+ private:
+  template <class Body>
+  void run(Body&& body) {
+    try {
+      body();
+    } catch (...) {
+      if (!error_) { error_ = std::current_exception(); cancel(); }
+    }
+    if (--pending_ == 0 && waiter_ >= 0) detail::wake(waiter_);
+  }
+
+  CancelToken        token_;
+  int                pending_ = 0;
+  int                waiter_  = -1;
+  std::exception_ptr error_;
+};
+
+// Run fn(i) for i in [begin, end) on green threads, grain indices per thread,
+// and wait for all of them (from main: via thread_run, see TaskGroup).
+// Rethrows the first exception.
+template <class F>
+void parallel_for(int begin, int end, int grain, F&& fn, int priority = 1) {
+  if (end <= begin) return;
+  grain = grain < 1 ? 1 : grain;
+  int chunks = (end - begin + grain - 1) / grain;
+  TaskGroup g;
+  g.spawn_n(chunks, [&](int c) {
+    int lo = begin + c * grain;
+    int hi = end - lo < grain ? end : lo + grain;
+    for (int i = lo; i < hi; ++i) fn(i);
+  }, "parallel_for", priority);
+  g.wait();
+}
+
 } // namespace mini_os
 
 #endif // THREADLIB_HPP
\ No newline at end of file
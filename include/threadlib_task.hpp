@@ -0,0 +1,283 @@
+#ifndef THREADLIB_TASK_HPP
+#define THREADLIB_TASK_HPP
+
+// Stackless C++20 coroutine tasks and channels on the threadlib scheduler.
+//
+// A Task<T> is a lazily started coroutine. task_spawn() hands a Task<void> to
+// the runtime, which queues it under the current policy exactly like a green
+// thread (same tids, priorities, MLFQ levels, log events) but resumes it on the
+// scheduler's own stack: a task costs its coroutine frame, not a 64 KiB stack.
+// Inside a task, block with the co_await forms below; the stackful thread_*
+// blocking calls are an error there. Tasks can co_await other Task<T>s.
+
+#include "threadlib.hpp"
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <optional>
+#include <string>
+#include <utility>
+
+namespace mini_os {
+
+namespace detail {
+int  task_register(std::coroutine_handle<> h, const std::string& name, int priority);
+void task_sleep(std::coroutine_handle<> h, int ms);
+void task_wait(std::coroutine_handle<> h, const std::string& resource);
+void task_yield(std::coroutine_handle<> h);
+void task_block(std::coroutine_handle<> h);
+
+struct TaskPromiseBase {
+  std::coroutine_handle<> continuation; // parent awaiting this task, if any
+  std::exception_ptr      error;
+
+  struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+    template <class P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+      auto& p = h.promise();
+      if (p.continuation) return p.continuation;
+      // a spawned task let an exception escape, like an uncaught one in a thread
+      if (p.error) std::terminate();
+      return std::noop_coroutine();
+    }
+    void await_resume() noexcept {}
+  };
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  FinalAwaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() noexcept { error = std::current_exception(); }
+};
+
+template <class T>
+struct TaskPromise : TaskPromiseBase {
+  std::optional<T> value;
+  template <class U>
+  void return_value(U&& v) { value.emplace(std::forward<U>(v)); }
+  T take() {
+    if (error) std::rethrow_exception(error);
+    return std::move(*value);
+  }
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase {
+  void return_void() noexcept {}
+  void take() {
+    if (error) std::rethrow_exception(error);
+  }
+};
+} // namespace detail
+
+template <class T = void>
+class [[nodiscard]] Task {
+ public:
+  struct promise_type : detail::TaskPromise<T> {
+    Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+  };
+  using handle_type = std::coroutine_handle<promise_type>;
+
+  Task(Task&& o) noexcept : h_(std::exchange(o.h_, {})) {}
+  Task& operator=(Task&& o) noexcept {
+    if (this != &o) { if (h_) h_.destroy(); h_ = std::exchange(o.h_, {}); }
+    return *this;
+  }
+  ~Task() { if (h_) h_.destroy(); }
+
+  // Awaiting a task starts it and resumes the awaiter with its result.
+  auto operator co_await() && noexcept {
+    struct Awaiter {
+      handle_type h;
+      bool await_ready() noexcept { return false; }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> parent) noexcept {
+        h.promise().continuation = parent;
+        return h;
+      }
+      T await_resume() { return h.promise().take(); }
+    };
+    return Awaiter{h_};
+  }
+
+  handle_type release() noexcept { return std::exchange(h_, {}); }
+
+ private:
+  explicit Task(handle_type h) : h_(h) {}
+  handle_type h_;
+};
+
+// Queue a task on the scheduler; returns its tid. The runtime owns the frame.
+inline int task_spawn(Task<void> task, const std::string& name = "task", int priority = 1) {
+  return detail::task_register(task.release(), name, priority);
+}
+
+// co_await task_sleep(ms) / task_wait(resource) / task_yield(): the stackless
+// counterparts of thread_sleep, thread_wait and thread_yield. Sleep and wait
+// yield false if the task was cancelled (thread_cancel works on tasks too).
+struct SleepAwaiter {
+  int ms;
+  bool await_ready() const { return thread_cancelled(); }
+  void await_suspend(std::coroutine_handle<> h) const { detail::task_sleep(h, ms); }
+  bool await_resume() const { return !thread_cancelled(); }
+};
+inline SleepAwaiter task_sleep(int ms) { return {ms}; }
+
+struct WaitAwaiter {
+  std::string resource;
+  bool await_ready() const { return thread_cancelled(); }
+  void await_suspend(std::coroutine_handle<> h) const { detail::task_wait(h, resource); }
+  bool await_resume() const { return !thread_cancelled(); }
+};
+inline WaitAwaiter task_wait(std::string resource) { return {std::move(resource)}; }
+
+struct YieldAwaiter {
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> h) const { detail::task_yield(h); }
+  void await_resume() const noexcept {}
+};
+inline YieldAwaiter task_yield() { return {}; }
+
+// FIFO channel shared by green threads (send/recv block the thread) and tasks
+// (co_await async_send/async_recv). capacity 0 is a rendezvous: a send
+// completes only when a receiver takes the value. Values are handed directly
+// to a parked receiver, so a woken receiver never finds the channel empty.
+// A cancelled caller gets false / nullopt unless its value was already handed
+// over; thread_cancelled() tells that apart from a closed channel.
+template <class T>
+class Channel {
+ public:
+  explicit Channel(std::size_t capacity = 0) : cap_(capacity) {}
+  Channel(const Channel&) = delete;
+  Channel& operator=(const Channel&) = delete;
+
+  // Returns false if the channel is closed.
+  bool send(T v) {
+    Status st = try_send(v);
+    if (st != Status::Blocked) return st == Status::Done;
+    bool ok = false;
+    int tid = detail::current_tid();
+    senders_.push_back({tid, &v, &ok});
+    if (!detail::block_current() && !ok) forget(senders_, tid);
+    return ok;
+  }
+
+  // nullopt once the channel is closed and drained.
+  std::optional<T> recv() {
+    std::optional<T> out;
+    if (try_recv(out)) return out;
+    int tid = detail::current_tid();
+    receivers_.push_back({tid, &out});
+    if (!detail::block_current() && !out) forget(receivers_, tid);
+    return out;
+  }
+
+  auto async_send(T v) {
+    struct Awaiter {
+      Channel* ch;
+      T        v;
+      bool     ok = false;
+      bool await_ready() {
+        if (thread_cancelled()) return true;
+        Status st = ch->try_send(v);
+        ok = st == Status::Done;
+        return st != Status::Blocked;
+      }
+      void await_suspend(std::coroutine_handle<> h) {
+        ch->senders_.push_back({detail::current_tid(), &v, &ok});
+        detail::task_block(h);
+      }
+      bool await_resume() {
+        if (!ok && thread_cancelled()) ch->forget(ch->senders_, detail::current_tid());
+        return ok;
+      }
+    };
+    return Awaiter{this, std::move(v)};
+  }
+
+  auto async_recv() {
+    struct Awaiter {
+      Channel*         ch;
+      std::optional<T> out;
+      bool await_ready() { return thread_cancelled() || ch->try_recv(out); }
+      void await_suspend(std::coroutine_handle<> h) {
+        ch->receivers_.push_back({detail::current_tid(), &out});
+        detail::task_block(h);
+      }
+      std::optional<T> await_resume() {
+        if (!out && thread_cancelled()) ch->forget(ch->receivers_, detail::current_tid());
+        return std::move(out);
+      }
+    };
+    return Awaiter{this, std::nullopt};
+  }
+
+  // Wakes every parked receiver (nullopt) and sender (false).
+  void close() {
+    closed_ = true;
+    for (auto& r : receivers_) detail::wake(r.tid);
+    for (auto& s : senders_) { *s.ok = false; detail::wake(s.tid); }
+    receivers_.clear();
+    senders_.clear();
+  }
+
+  bool        closed() const { return closed_; }
+  std::size_t size() const { return buf_.size(); }
+
+ private:
+  enum class Status { Done, Closed, Blocked };
+  struct Sender   { int tid; T* value; bool* ok; };
+  struct Receiver { int tid; std::optional<T>* slot; };
+
+  Status try_send(T& v) {
+    if (closed_) return Status::Closed;
+    if (!receivers_.empty()) {
+      Receiver r = receivers_.front();
+      receivers_.pop_front();
+      r.slot->emplace(std::move(v));
+      detail::wake(r.tid);
+      return Status::Done;
+    }
+    if (buf_.size() < cap_) { buf_.push_back(std::move(v)); return Status::Done; }
+    return Status::Blocked;
+  }
+
+  // true when resolved: out holds a value, or stays empty because closed.
+  bool try_recv(std::optional<T>& out) {
+    if (!buf_.empty()) {
+      out.emplace(std::move(buf_.front()));
+      buf_.pop_front();
+      if (!senders_.empty()) buf_.push_back(take_sender());
+      return true;
+    }
+    if (!senders_.empty()) { out.emplace(take_sender()); return true; }
+    return closed_;
+  }
+
+  // Drop a cancelled waiter's entry (no-op if already served).
+  template <class Q>
+  static void forget(Q& q, int tid) {
+    for (auto it = q.begin(); it != q.end(); ++it) {
+      if (it->tid == tid) { q.erase(it); return; }
+    }
+  }
+
+  T take_sender() {
+    Sender s = senders_.front();
+    senders_.pop_front();
+    *s.ok = true;
+    detail::wake(s.tid);
+    return std::move(*s.value);
+  }
+
+  std::deque<T>        buf_;
+  std::deque<Sender>   senders_;
+  std::deque<Receiver> receivers_;
+  std::size_t          cap_;
+  bool                 closed_ = false;
+};
+
+} // namespace mini_os
+
+#endif // THREADLIB_TASK_HPP
@@ -1,9 +1,12 @@
 #include "threadlib.hpp"
 
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <cassert>
 #include <chrono>
+#include <condition_variable>
+#include <coroutine>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
@@ -14,7 +17,11 @@
 #include <iostream>
 #include <map>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
 #include <optional>
+#include <ranges>
 #include <string>
 #include <thread>
 #include <unordered_map>
@@ -25,7 +32,33 @@
   #define NOMINMAX
   #include <windows.h>
 #else
+  #include <cerrno>
+  #include <arpa/inet.h>
+  #include <fcntl.h>
+  #include <netinet/in.h>
+  #include <poll.h>
+  #include <sys/socket.h>
+  #include <sys/un.h>
   #include <ucontext.h>
+  #include <unistd.h>
+#endif
+
+#if defined(__linux__)
+  #include <linux/io_uring.h>
+  #include <sys/epoll.h>
+  #include <sys/eventfd.h>
+  #include <sys/mman.h>
+  #include <sys/syscall.h>
+  #include <sys/timerfd.h>
+#endif
+
+// Vector kernels for the per-pass thread scans (see "Scan kernels").
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+  #define THREADLIB_SCAN_AVX2 1
+  #include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  #define THREADLIB_SCAN_NEON 1
+  #include <arm_neon.h>
 #endif
 
 namespace mini_os {
@@ -39,7 +72,8 @@ static inline int64_t now_ms() {
 // ------------------------------ Logging -------------------------------------
 struct Logger {
   std::ofstream out;
-  Logger(const char* path) {
+  explicit Logger(const std::string& path) { // empty path: logging off
+    if (path.empty()) return;
     out.open(path, std::ios::out | std::ios::trunc);
     if (out.is_open()) out << "t_us,event,tid,info\n";
   }
@@ -48,11 +82,9 @@ struct Logger {
     out << now_ms() << "," << event << "," << tid << "," << info << "\n";
   }
 };
-static Logger g_log("schedule_log.csv");
-
 // ------------------------------ Thread core ---------------------------------
 
-enum class ThreadState { NEW, READY, RUNNING, BLOCKED, SLEEPING, FINISHED };
+enum class ThreadState : uint8_t { NEW, READY, RUNNING, BLOCKED, SLEEPING, FINISHED };
 
 struct Context;
 struct Thread;
@@ -62,68 +94,516 @@ struct WaitQueue {
   void push(int tid) { q.push_back(tid); }
   bool empty() const { return q.empty(); }
   int  pop() { int t = q.front(); q.pop_front(); return t; }
+  void remove(int tid) { q.erase(std::remove(q.begin(), q.end(), tid), q.end()); }
+};
+
+// What a BLOCKED thread is waiting for; decides how thread_cancel wakes it.
+enum class BlockKind : uint8_t {
+  None,
+  Resource,  // thread_wait: in waiting_on's queue
+  Io,        // io_uring operation in flight: cancelled in the kernel
+  Park,      // detail::block_current (channels): woken directly
+  Uncancellable, // offload job or group join: cancellation reported on return
 };
 
-// Named resource -> wait queue
-static std::map<std::string, WaitQueue> g_resources;
+// Slot TLS: names registered by tls_key_create; values live in each Thread.
+struct TlsSlots {
+  std::array<std::intptr_t, TLS_SLOTS> value{};
+  uint32_t present = 0; // bit per slot
+};
+// Slot names are process-wide, so a key is valid in every runtime.
+static std::mutex               g_tls_keys_mu;
+static std::vector<std::string> g_tls_keys;
+
+// GreenLocal<T> values: constructed on first use, destroyed at FINISHED.
+struct LocalValue {
+  void* obj = nullptr;
+  void (*dtor)(void*) = nullptr;
+  size_t size = 0; // sizeof the value, for memory_stats
+};
+static std::atomic<int> g_local_keys{0};
+
+// thread_alloc arena: bumps through chunks from operator new, growing 4 KiB ->
+// 64 KiB; requests over a quarter of that get a chunk of their own, linked
+// in without abandoning the current one. release() frees them all.
+struct Arena final : std::pmr::memory_resource {
+  struct Chunk { Chunk* prev; size_t size; };
+  static constexpr size_t MIN_CHUNK = 4 << 10;
+  static constexpr size_t MAX_CHUNK = 64 << 10;
+
+  Chunk* head = nullptr;
+  char*  cur = nullptr;
+  char*  end = nullptr;
+  size_t reserved = 0; // bytes held in chunks
+
+  Arena() = default;
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+  ~Arena() override { release(); }
+
+  void* alloc(size_t size, size_t align) {
+    if (size + align > MAX_CHUNK / 4) {
+      Chunk* c = new_chunk(sizeof(Chunk) + size + align);
+      if (head) { c->prev = head->prev; head->prev = c; } // keep cur
+      else head = c;
+      return align_up((char*)(c + 1), align);
+    }
+    char* p = cur ? align_up(cur, align) : nullptr;
+    if (!p || p + size > end) {
+      size_t next = head ? std::min(head->size * 2, MAX_CHUNK) : MIN_CHUNK;
+      next = std::max(next, sizeof(Chunk) + size + align); // a request may outgrow the step
+      Chunk* c = new_chunk(next);
+      c->prev = head;
+      head = c;
+      cur = (char*)(c + 1);
+      end = (char*)c + next;
+      p = align_up(cur, align);
+    }
+    cur = p + size;
+    return p;
+  }
+
+  void release() {
+    while (head) {
+      Chunk* prev = head->prev;
+      ::operator delete(head);
+      head = prev;
+    }
+    cur = end = nullptr;
+    reserved = 0;
+  }
+
+ private:
+  static char* align_up(char* p, size_t align) {
+    return (char*)(((uintptr_t)p + align - 1) & ~(uintptr_t)(align - 1));
+  }
+  Chunk* new_chunk(size_t bytes) {
+    auto* c = (Chunk*)::operator new(bytes);
+    c->prev = nullptr;
+    c->size = bytes;
+    reserved += bytes;
+    return c;
+  }
 
-// TLS per thread
-static std::unordered_map<int, std::unordered_map<std::string, std::intptr_t>> g_tls;
+  void* do_allocate(size_t bytes, size_t align) override { return alloc(bytes, align); }
+  void  do_deallocate(void*, size_t, size_t) override {}
+  bool  do_is_equal(const std::pmr::memory_resource& o) const noexcept override { return this == &o; }
+};
 
 // Cross-platform lightweight context
 #if defined(_WIN32)
 struct Context {
   LPVOID fiber = nullptr;
 };
-static LPVOID g_mainFiber = nullptr;
+constexpr size_t STACK_SIZE = 0;       // fibers allocate their own stacks
 #else
 constexpr size_t STACK_SIZE = 1 << 16; // 64 KiB
 struct Context {
   ucontext_t ctx{};
-  std::unique_ptr<char[]> stack;
+  char*  stack = nullptr;            // owned by ThreadTable's stack slabs
+  size_t usable = STACK_SIZE;        // below the callable stored at the top
+  bool made = false;                 // makecontext() done
 };
-static ucontext_t g_sched_ctx;
 #endif
 
+// Cold per-thread record. The fields the loop scans for every thread (state,
+// sleep deadline) live in ThreadTable's hot arrays instead.
 struct Thread {
   int            tid = -1;
   int            base_priority = 1;  // 1..10
-  int            dyn_priority  = 1;
-  ThreadState    state = ThreadState::NEW;
+  int            dyn_priority  = 1;  // Priority policy: base..10, as last queued; see Scheduler
   std::string    name;
-  std::function<void()> func;
+  void         (*invoke)(void*) = nullptr; // type-erased entry (thread_spawn)
+  void         (*destroy)(void*) = nullptr;
+  void*          fn_obj = nullptr;   // the callable: top of the stack, or heap
+  size_t         fn_heap_align = 0;  // nonzero when fn_obj was heap-allocated
+  size_t         fn_size = 0;        // bytes of the callable, for memory_stats
   Context        cx;
-  int64_t        wake_time_ms = 0;   // for sleeping
   int            quantum_budget = 8; // remaining work units before auto-yield
-  int            mlfq_level = 0;     // 0 is highest
+  int            mlfq_level = 0;     // 0 is highest; read through level_of()
+  int            level_used = 0;     // work units used at mlfq_level so far
+  int64_t        ready_since = 0;    // woken at (us), until dispatched; MLFQ tuner only
+  uint32_t       mlfq_epoch = 0;     // boost epoch mlfq_level was set in
+  int            run_next = -1;      // links in a run-queue TidList
+  int            run_prev = -1;
+  uint32_t       prio_ages = 0;      // Scheduler::prio_ages when queued (Priority)
+  int            stale_queued = 0;   // custom-policy entries to skip (taken by yield_to)
+  int64_t        io_result = 0;      // completion result of the last green_* call
+  std::coroutine_handle<> coro_root; // stackless task: frame owned by the runtime
+  std::coroutine_handle<> coro;      // where the task resumes next
+  BlockKind      block = BlockKind::None;
+  WaitQueue*     waiting_on = nullptr; // BlockKind::Resource
+  bool           cancel_requested = false;
+  TlsSlots       tls;
+  std::vector<LocalValue> locals;    // GreenLocal values, indexed by key
+  Arena          arena;              // thread_alloc, released at FINISHED
+};
+
+// Thread records live in slabs that never move (a saved ucontext_t must stay
+// put); index_ maps tid -> record. Single spawns take records from small
+// slabs, thread_create_n gets one slab (and one stack block) for the batch.
+// State and wake time are kept apart in dense arrays indexed by tid, so the
+// sleeper and NEW scans read 1 + 8 bytes per thread instead of a record of
+// several hundred bytes.
+class ThreadTable {
+ public:
+  using Index = std::vector<Thread*>;
+  struct iterator {
+    Index::const_iterator it;
+    Thread& operator*() const { return **it; }
+    iterator& operator++() { ++it; return *this; }
+    bool operator!=(const iterator& o) const { return it != o.it; }
+  };
+
+  Thread&  operator[](int tid) { return *index_[tid]; }
+  const Thread& operator[](int tid) const { return *index_[tid]; }
+  size_t   size() const { return index_.size(); }
+  iterator begin() const { return {index_.begin()}; }
+  iterator end() const { return {index_.end()}; }
+
+  ThreadState& state(int tid) { return state_[tid]; }
+  ThreadState  state(int tid) const { return state_[tid]; }
+  int64_t&     wake_time(int tid) { return wake_[tid]; } // SLEEPING only, in us
+  const ThreadState* states() const { return state_.data(); }
+  const int64_t*     wake_times() const { return wake_.data(); }
+
+  Thread& emplace_back() {
+    if (slab_left_ == 0) {
+      slabs_.push_back(std::make_unique<Thread[]>(SLAB));
+      records_ += SLAB;
+      slab_next_ = slabs_.back().get();
+      slab_left_ = SLAB;
+    }
+    --slab_left_;
+    index_.push_back(slab_next_);
+    state_.push_back(ThreadState::NEW);
+    wake_.push_back(0);
+    return *slab_next_++;
+  }
+
+  // count fresh records from a single allocation; returns the first.
+  Thread* emplace_n(size_t count) {
+    slabs_.push_back(std::make_unique<Thread[]>(count));
+    records_ += count;
+    Thread* first = slabs_.back().get();
+    if (index_.size() + count > index_.capacity()) { // grow geometrically
+      index_.reserve(std::max(2 * index_.capacity(), index_.size() + count));
+    }
+    for (size_t i = 0; i < count; ++i) index_.push_back(first + i);
+    state_.resize(index_.size(), ThreadState::NEW);
+    wake_.resize(index_.size(), 0);
+    return first;
+  }
+
+  // Uninitialised stack memory for count threads in one allocation.
+  char* alloc_stacks(size_t count) {
+    stacks_.push_back(std::make_unique_for_overwrite<char[]>(count * STACK_SIZE));
+    stack_bytes_ += count * STACK_SIZE;
+    return stacks_.back().get();
+  }
+
+  // Memory held by the table itself: record slabs plus index and hot arrays.
+  size_t record_bytes() const {
+    return records_ * sizeof(Thread) + index_.capacity() * sizeof(Thread*) +
+           state_.capacity() * sizeof(ThreadState) + wake_.capacity() * sizeof(int64_t);
+  }
+  size_t stack_bytes() const { return stack_bytes_; }
+
+ private:
+  static constexpr size_t SLAB = 64;
+  Index   index_;
+  std::vector<ThreadState> state_; // hot: by tid
+  std::vector<int64_t>     wake_;
+  std::vector<std::unique_ptr<Thread[]>> slabs_;
+  std::vector<std::unique_ptr<char[]>>   stacks_;
+  Thread* slab_next_ = nullptr;
+  size_t  slab_left_ = 0;
+  size_t  records_ = 0;     // Thread records allocated, used or not
+  size_t  stack_bytes_ = 0;
 };
 
+// ------------------------------ Scan kernels --------------------------------
+
+// The loop's two whole-table scans over ThreadTable's hot arrays: sleepers
+// whose deadline has passed, and threads in a given state. Each appends the
+// matching tids in [first, n) to out in ascending order. AVX2 (picked at run
+// time) and NEON versions test 32 / 16 states per step and skip blocks with no
+// match, then compare deadlines 4 / 2 lanes at a time; the scalar loops are
+// the fallback and handle the tail.
+
+// Returns the earliest deadline among sleepers still not due (INT64_MAX if
+// none).
+static int64_t scan_due_scalar(const ThreadState* st, const int64_t* wake, int first, int n,
+                               int64_t now, std::vector<int>& out) {
+  int64_t next = INT64_MAX;
+  for (int i = first; i < n; ++i) {
+    if (st[i] != ThreadState::SLEEPING) continue;
+    if (wake[i] <= now) out.push_back(i);
+    else next = std::min(next, wake[i]);
+  }
+  return next;
+}
+
+static void scan_state_scalar(const ThreadState* st, int first, int n, ThreadState want,
+                              std::vector<int>& out) {
+  for (int i = first; i < n; ++i) {
+    if (st[i] == want) out.push_back(i);
+  }
+}
+
+#if defined(THREADLIB_SCAN_AVX2)
+
+static bool cpu_has_avx2() {
+  static const bool ok = __builtin_cpu_supports("avx2");
+  return ok;
+}
+
+__attribute__((target("avx2")))
+static int64_t scan_due_avx2(const ThreadState* st, const int64_t* wake, int n, int64_t now,
+                             std::vector<int>& out) {
+  const __m256i sleeping8  = _mm256_set1_epi8((char)ThreadState::SLEEPING);
+  const __m256i sleeping64 = _mm256_set1_epi64x((int64_t)ThreadState::SLEEPING);
+  const __m256i nowv = _mm256_set1_epi64x(now);
+  const __m256i maxv = _mm256_set1_epi64x(INT64_MAX);
+  __m256i nextv = maxv;
+  int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i s = _mm256_loadu_si256((const __m256i*)(st + i));
+    uint32_t block = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(s, sleeping8));
+    for (int g = 0; block; g += 4, block >>= 4) {
+      if (!(block & 0xF)) continue;
+      int32_t s4;
+      std::memcpy(&s4, st + i + g, 4);
+      __m256i is_sl = _mm256_cmpeq_epi64(_mm256_cvtepu8_epi64(_mm_cvtsi32_si128(s4)), sleeping64);
+      __m256i w     = _mm256_loadu_si256((const __m256i*)(wake + i + g));
+      __m256i later = _mm256_cmpgt_epi64(w, nowv);
+      int due = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_andnot_si256(later, is_sl)));
+      for (; due; due &= due - 1) out.push_back(i + g + __builtin_ctz(due));
+      __m256i cand = _mm256_blendv_epi8(maxv, w, _mm256_and_si256(later, is_sl));
+      nextv = _mm256_blendv_epi8(nextv, cand, _mm256_cmpgt_epi64(nextv, cand));
+    }
+  }
+  alignas(32) int64_t lanes[4];
+  _mm256_store_si256((__m256i*)lanes, nextv);
+  int64_t next = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+  return std::min(next, scan_due_scalar(st, wake, i, n, now, out));
+}
+
+__attribute__((target("avx2")))
+static void scan_state_avx2(const ThreadState* st, int n, ThreadState want, std::vector<int>& out) {
+  const __m256i wantv = _mm256_set1_epi8((char)want);
+  int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i s = _mm256_loadu_si256((const __m256i*)(st + i));
+    uint32_t m = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(s, wantv));
+    for (; m; m &= m - 1) out.push_back(i + __builtin_ctz(m));
+  }
+  scan_state_scalar(st, i, n, want, out);
+}
+
+#elif defined(THREADLIB_SCAN_NEON)
+
+static int64_t scan_due_neon(const ThreadState* st, const int64_t* wake, int n, int64_t now,
+                             std::vector<int>& out) {
+  const uint8x16_t sleeping = vdupq_n_u8((uint8_t)ThreadState::SLEEPING);
+  const int64x2_t  nowv = vdupq_n_s64(now);
+  const int64x2_t  maxv = vdupq_n_s64(INT64_MAX);
+  int64x2_t nextv = maxv;
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t eq = vceqq_u8(vld1q_u8((const uint8_t*)(st + i)), sleeping);
+    if (vmaxvq_u8(eq) == 0) continue;
+    // Widen the 0x00/0xFF byte mask to one 64-bit lane mask per thread.
+    int8x16_t e = vreinterpretq_s8_u8(eq);
+    int16x8_t h[2] = {vmovl_s8(vget_low_s8(e)), vmovl_s8(vget_high_s8(e))};
+    for (int a = 0; a < 2; ++a) {
+      int32x4_t q[2] = {vmovl_s16(vget_low_s16(h[a])), vmovl_s16(vget_high_s16(h[a]))};
+      for (int b = 0; b < 2; ++b) {
+        int64x2_t m[2] = {vmovl_s32(vget_low_s32(q[b])), vmovl_s32(vget_high_s32(q[b]))};
+        for (int c = 0; c < 2; ++c) {
+          int j = i + a * 8 + b * 4 + c * 2;
+          uint64x2_t is_sl = vreinterpretq_u64_s64(m[c]);
+          int64x2_t  w     = vld1q_s64(wake + j);
+          uint64x2_t later = vcgtq_s64(w, nowv);
+          uint64x2_t due   = vbicq_u64(is_sl, later);
+          if (vgetq_lane_u64(due, 0)) out.push_back(j);
+          if (vgetq_lane_u64(due, 1)) out.push_back(j + 1);
+          int64x2_t cand = vbslq_s64(vandq_u64(later, is_sl), w, maxv);
+          nextv = vbslq_s64(vcltq_s64(cand, nextv), cand, nextv);
+        }
+      }
+    }
+  }
+  int64_t next = std::min(vgetq_lane_s64(nextv, 0), vgetq_lane_s64(nextv, 1));
+  return std::min(next, scan_due_scalar(st, wake, i, n, now, out));
+}
+
+static void scan_state_neon(const ThreadState* st, int n, ThreadState want, std::vector<int>& out) {
+  const uint8x16_t wantv = vdupq_n_u8((uint8_t)want);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t eq = vceqq_u8(vld1q_u8((const uint8_t*)(st + i)), wantv);
+    if (vmaxvq_u8(eq) == 0) continue;
+    scan_state_scalar(st, i, i + 16, want, out);
+  }
+  scan_state_scalar(st, i, n, want, out);
+}
+
+#endif
+
+static int64_t scan_due(const ThreadState* st, const int64_t* wake, int n, int64_t now,
+                        std::vector<int>& out) {
+#if defined(THREADLIB_SCAN_AVX2)
+  if (cpu_has_avx2()) return scan_due_avx2(st, wake, n, now, out);
+#elif defined(THREADLIB_SCAN_NEON)
+  return scan_due_neon(st, wake, n, now, out);
+#endif
+  return scan_due_scalar(st, wake, 0, n, now, out);
+}
+
+static void scan_state(const ThreadState* st, int n, ThreadState want, std::vector<int>& out) {
+#if defined(THREADLIB_SCAN_AVX2)
+  if (cpu_has_avx2()) return scan_state_avx2(st, n, want, out);
+#elif defined(THREADLIB_SCAN_NEON)
+  return scan_state_neon(st, n, want, out);
+#endif
+  scan_state_scalar(st, 0, n, want, out);
+}
+
 // ------------------------------ Scheduler -----------------------------------
 
+// FIFO of tids doubly linked through Thread::run_next / run_prev: O(1) push,
+// pop, removing a given tid and splicing a whole list onto another.
+struct TidList {
+  int    head = -1, tail = -1;
+  size_t n = 0;
+
+  bool empty() const { return n == 0; }
+
+  void push_back(ThreadTable& ths, int tid) {
+    ths[tid].run_next = -1;
+    ths[tid].run_prev = tail;
+    if (tail >= 0) ths[tail].run_next = tid;
+    else head = tid;
+    tail = tid;
+    ++n;
+  }
+
+  int pop_front(ThreadTable& ths) {
+    int t = head;
+    head = ths[t].run_next;
+    if (head >= 0) ths[head].run_prev = -1;
+    else tail = -1;
+    --n;
+    return t;
+  }
+
+  // tid must be on this list.
+  void remove(ThreadTable& ths, int tid) {
+    int prev = ths[tid].run_prev, next = ths[tid].run_next;
+    if (prev >= 0) ths[prev].run_next = next;
+    else head = next;
+    if (next >= 0) ths[next].run_prev = prev;
+    else tail = prev;
+    --n;
+  }
+
+  void splice_back(ThreadTable& ths, TidList& o) {
+    if (o.empty()) return;
+    if (tail >= 0) ths[tail].run_next = o.head;
+    else head = o.head;
+    ths[o.head].run_prev = tail;
+    tail = o.tail;
+    n += o.n;
+    o = {};
+  }
+};
+
+// Optional MLFQ controller. Every period it takes the p99 wakeup latency
+// (from a sleeper's deadline, or a signal / I/O completion, until dispatch)
+// and retunes: above target, quanta and the aging interval shrink by a
+// quarter, and a level is added once quanta bottom out; with at least 2x
+// headroom they grow back, trading the spare latency for fewer switches of
+// CPU-bound threads.
+struct MlfqTuner {
+  int64_t target_us = 0;  // 0: off
+  int64_t period_us = 100000;
+  int64_t last_us = 0;
+  std::vector<int64_t> samples; // this period's latencies, first MAX_SAMPLES
+  int64_t units = 0;      // thread_work units this period
+  int64_t dispatches = 0;
+  static constexpr size_t MAX_SAMPLES = 4096;
+  static constexpr int MIN_QUANTUM = 1, MAX_QUANTUM = 64;
+  static constexpr int MIN_AGING_MS = 10, MAX_AGING_MS = 2000;
+};
+
 struct Scheduler {
   SchedPolicy policy = SchedPolicy::RoundRobin;
 
-  // Round-robin / priority queue
-  std::deque<int> rrq;
-
-  // MLFQ queues
-  std::vector<std::deque<int>> mlfq;
+  // Round-robin queue
+  TidList rrq;
+
+  // Priority: one FIFO per dyn_priority, highest first. Waiting READY raises
+  // dyn_priority by one per prio_age_interval_ms (every list spliced up a
+  // level, O(10)); each dispatch spends a point, down to base_priority; a
+  // thread that blocks returns to its base. Low priorities therefore wait at
+  // most about (10 - base) intervals, and a thread never drops below its base.
+  // Aging moves whole lists and leaves Thread::dyn_priority as it was queued;
+  // the field catches up when the thread leaves its list (pop, take, drain).
+  static constexpr int MAX_PRIORITY = 10;
+  std::array<TidList, MAX_PRIORITY + 1> prio{}; // [0] unused
+  size_t  prio_n = 0;
+  uint32_t prio_ages = 0; // aging passes that moved lists, see prio_list_of
+  int     prio_age_interval_ms = 100;
+  int64_t last_prio_age = now_ms();
+
+  // MLFQ queues. Aging is the periodic global boost: every aging interval all
+  // threads go back to level 0. Queued ones are moved by splicing the level
+  // lists, the rest by bumping boost_epoch, which makes every older
+  // mlfq_level read as 0 (see level_of) — O(levels) however many threads.
+  std::vector<TidList> mlfq;
   int levels = 3;
   std::vector<int> quantum_by_level = {8, 4, 2};
+  // Work units a thread may use at a level, summed over all its runs there,
+  // before it is demoted; sleeping or yielding does not reset it. Levels
+  // without an entry (or <= 0) allot one quantum.
+  std::vector<int> allotment_by_level;
   bool enable_aging = true;
   int  aging_interval_ms = 500;
-  int64_t last_age_ms = now_ms();
+  int64_t last_age_ms = now_ms(); // microseconds, like now_ms()
+  uint32_t boost_epoch = 0;
+  size_t stale = 0; // Custom: queued entries of threads take() already ran
+  MlfqTuner tuner;
+
+  // User policy object (SchedPolicy::Custom)
+  void* custom = nullptr;
+  const detail::PolicyOps* ops = nullptr;
+
+  // Queue storage outside the thread records (the lists are intrusive).
+  size_t queue_bytes() const {
+    return mlfq.capacity() * sizeof(TidList) +
+           (quantum_by_level.capacity() + allotment_by_level.capacity()) * sizeof(int) +
+           tuner.samples.capacity() * sizeof(int64_t);
+  }
 
-  void set_policy_from_env() {
+  static SchedThread view(const ThreadTable& ths, int tid) {
+    const Thread& th = ths[tid];
+    return {tid, th.base_priority, th.dyn_priority};
+  }
+
+  // Batches from thread_create_n are queued before thread_run, so the env
+  // override migrates them like set_policy does.
+  void set_policy_from_env(ThreadTable& ths) {
+    if (policy == SchedPolicy::Custom && custom) return; // an explicit policy object wins
     if (policy != SchedPolicy::RoundRobin && policy != SchedPolicy::Priority && policy != SchedPolicy::MLFQ) {
       policy = SchedPolicy::RoundRobin;
     }
     const char* s = std::getenv("SCHED");
     if (!s) return;
     std::string v(s);
-    if (v == "prio" || v == "priority") policy = SchedPolicy::Priority;
-    else if (v == "mlfq") policy = SchedPolicy::MLFQ;
-    else policy = SchedPolicy::RoundRobin;
+    if (v == "prio" || v == "priority") switch_policy(ths, SchedPolicy::Priority);
+    else if (v == "mlfq") switch_policy(ths, SchedPolicy::MLFQ);
+    else switch_policy(ths, SchedPolicy::RoundRobin);
   }
 
   void init_mlfq_if_needed() {
@@ -134,210 +614,1432 @@ struct Scheduler {
     }
   }
 
-  void enqueue_rr(int tid) { rrq.push_back(tid); }
+  // Ready tids in the order the current policy would dispatch them; empties
+  // the queues.
+  std::vector<int> drain(ThreadTable& ths) {
+    std::vector<int> out = drain_entries(ths);
+    std::erase_if(out, [&](int t) {
+      if (ths[t].stale_queued == 0) return false;
+      --ths[t].stale_queued;
+      --stale;
+      return true;
+    });
+    return out;
+  }
+
+  std::vector<int> drain_entries(ThreadTable& ths) {
+    std::vector<int> out;
+    if (policy == SchedPolicy::MLFQ) {
+      for (auto& q : mlfq) while (!q.empty()) out.push_back(q.pop_front(ths));
+    } else if (policy == SchedPolicy::Custom) {
+      for (int t; !ops->empty(custom) && (t = ops->pop(custom)) >= 0;) out.push_back(t);
+    } else if (policy == SchedPolicy::Priority) {
+      for (int p = MAX_PRIORITY; p > 0; --p) {
+        while (!prio[p].empty()) {
+          int t = prio[p].pop_front(ths);
+          ths[t].dyn_priority = p; // keep the boost aging gave it
+          out.push_back(t);
+        }
+      }
+      prio_n = 0;
+    } else {
+      while (!rrq.empty()) out.push_back(rrq.pop_front(ths));
+    }
+    return out;
+  }
+
+  // Switch policy, carrying every queued thread over in its current order
+  // (the new policy then orders them its own way).
+  void switch_policy(ThreadTable& ths, SchedPolicy p) {
+    if (p == policy || p == SchedPolicy::Custom) return; // objects: install()
+    std::vector<int> ready = drain(ths);
+    policy = p;
+    requeue(ths, ready);
+  }
+
+  // Make obj the active policy (replacing any previous policy object).
+  void install(ThreadTable& ths, void* obj, const detail::PolicyOps& o) {
+    std::vector<int> ready = drain(ths);
+    custom = obj;
+    ops = &o;
+    policy = SchedPolicy::Custom;
+    requeue(ths, ready);
+  }
+
+  // Change the MLFQ level count; queued threads below the new bottom level
+  // land on it. Quanta of the kept levels are preserved.
+  void set_levels(ThreadTable& ths, int n) {
+    if (n == levels) return;
+    std::vector<int> ready;
+    if (policy == SchedPolicy::MLFQ) ready = drain(ths);
+    levels = n;
+    for (int i = (int)quantum_by_level.size(); i < levels; ++i) quantum_by_level.push_back(std::max(1, 8 >> i));
+    quantum_by_level.resize(levels);
+    mlfq.resize(levels);
+    requeue(ths, ready);
+  }
+
+  void requeue(ThreadTable& ths, const std::vector<int>& ready) {
+    switch (policy) {
+      case SchedPolicy::RoundRobin:
+        for (int tid : ready) rrq.push_back(ths, tid);
+        break;
+      case SchedPolicy::Priority:
+        for (int tid : ready) enqueue_prio(ths, tid);
+        break;
+      case SchedPolicy::MLFQ:
+        for (int tid : ready) enqueue_mlfq(ths, tid);
+        break;
+      case SchedPolicy::Custom:
+        for (int tid : ready) ops->enqueue(custom, view(ths, tid));
+        break;
+    }
+  }
+
+  void enqueue_prio(ThreadTable& ths, int tid) {
+    auto& th = ths[tid];
+    th.dyn_priority = std::clamp(th.dyn_priority, th.base_priority, MAX_PRIORITY);
+    th.prio_ages = prio_ages;
+    prio[th.dyn_priority].push_back(ths, tid);
+    ++prio_n;
+  }
+
+  // The list a queued thread is on: each aging pass since it was queued moved
+  // it up one, up to MAX_PRIORITY.
+  int prio_list_of(const Thread& th) const {
+    uint32_t aged = prio_ages - th.prio_ages;
+    return (int)std::min<uint32_t>(MAX_PRIORITY, (uint32_t)th.dyn_priority + std::min<uint32_t>(aged, MAX_PRIORITY));
+  }
+
+  // dyn_priority including aging not yet written back (for reporting).
+  int current_dyn_priority(const ThreadTable& ths, int tid) const {
+    const Thread& th = ths[tid];
+    if (policy == SchedPolicy::Priority && ths.state(tid) == ThreadState::READY) return prio_list_of(th);
+    return th.dyn_priority;
+  }
 
-  void enqueue_prio(const std::vector<Thread>& ths, int tid) {
-    auto it = rrq.begin();
-    for (; it != rrq.end(); ++it) {
-      if (ths[tid].base_priority > ths[*it].base_priority) break;
+  // A thread's level, reset to 0 if a boost happened since it was set.
+  int& level_of(Thread& th) {
+    if (th.mlfq_epoch != boost_epoch) {
+      th.mlfq_epoch = boost_epoch;
+      th.mlfq_level = 0;
+      th.level_used = 0;
     }
-    rrq.insert(it, tid);
+    return th.mlfq_level;
+  }
+
+  int allotment(int lvl) const {
+    if (lvl < (int)allotment_by_level.size() && allotment_by_level[lvl] > 0) return allotment_by_level[lvl];
+    return quantum_by_level[lvl];
   }
 
-  void enqueue_mlfq(std::vector<Thread>& ths, int tid) {
+  void enqueue_mlfq(ThreadTable& ths, int tid) {
     init_mlfq_if_needed();
     auto& th = ths[tid];
-    th.mlfq_level = std::clamp(th.mlfq_level, 0, levels-1);
-    th.quantum_budget = quantum_by_level[th.mlfq_level];
-    mlfq[th.mlfq_level].push_back(tid);
+    int& lvl = level_of(th);
+    if (lvl >= levels) { lvl = levels - 1; th.level_used = 0; }
+    mlfq[lvl].push_back(ths, tid);
   }
 
-  void enqueue(std::vector<Thread>& ths, int tid) {
+  void enqueue(ThreadTable& ths, int tid) {
     switch (policy) {
-      case SchedPolicy::RoundRobin: enqueue_rr(tid); break;
+      case SchedPolicy::RoundRobin: rrq.push_back(ths, tid); break;
       case SchedPolicy::Priority:   enqueue_prio(ths, tid); break;
       case SchedPolicy::MLFQ:       enqueue_mlfq(ths, tid); break;
+      case SchedPolicy::Custom:     ops->enqueue(custom, view(ths, tid)); break;
     }
   }
 
-  bool empty() const {
+  // Queue tids [first, first+count), all of equal priority, in one insertion.
+  void enqueue_range(ThreadTable& ths, int first, int count) {
+    if (count <= 0) return;
+    auto ids = std::views::iota(first, first + count);
+    switch (policy) {
+      case SchedPolicy::RoundRobin:
+        for (int tid : ids) rrq.push_back(ths, tid);
+        break;
+      case SchedPolicy::Priority:
+        for (int tid : ids) enqueue_prio(ths, tid);
+        break;
+      case SchedPolicy::MLFQ: {
+        init_mlfq_if_needed();
+        for (int tid : ids) {
+          ths[tid].mlfq_level = 0;
+          ths[tid].mlfq_epoch = boost_epoch;
+          mlfq[0].push_back(ths, tid);
+        }
+        break;
+      }
+      case SchedPolicy::Custom:
+        for (int tid : ids) ops->enqueue(custom, view(ths, tid));
+        break;
+    }
+  }
+
+  // READY threads queued, not counting stale entries.
+  bool   empty() const { return size() == 0; }
+  size_t size() const {
+    size_t n = entries();
+    return n > stale ? n - stale : 0; // a user policy's size() may lag
+  }
+
+  // Take READY tid out of the run queue to run it now (yield_to, handoff).
+  // Built-in queues unlink it; a user policy cannot remove from the middle,
+  // so its entry stays and is marked stale for pop() and drain() to skip.
+  void take(ThreadTable& ths, int tid) {
+    auto& th = ths[tid];
+    switch (policy) {
+      case SchedPolicy::RoundRobin:
+        rrq.remove(ths, tid);
+        break;
+      case SchedPolicy::Priority: {
+        int p = prio_list_of(th);
+        prio[p].remove(ths, tid);
+        --prio_n;
+        th.dyn_priority = std::max(th.base_priority, p - 1); // as pop()
+        break;
+      }
+      case SchedPolicy::MLFQ:
+        mlfq[level_of(th)].remove(ths, tid);
+        break;
+      case SchedPolicy::Custom:
+        ++th.stale_queued;
+        ++stale;
+        break;
+    }
+  }
+
+  // Entries in the policy's queues, stale ones included.
+  size_t entries() const {
+    if (policy == SchedPolicy::Custom) return ops->size(custom);
     if (policy == SchedPolicy::MLFQ) {
-      for (auto& q : mlfq) if (!q.empty()) return false;
-      return true;
+      size_t n = 0;
+      for (auto& q : mlfq) n += q.n;
+      return n;
     }
-    return rrq.empty();
+    if (policy == SchedPolicy::Priority) return prio_n;
+    return rrq.n;
   }
 
-  int pop(std::vector<Thread>& ths) {
+  // Next thread to run, skipping a user policy's stale entries (see take).
+  int pop(ThreadTable& ths) {
+    for (;;) {
+      int t = pop_entry(ths);
+      if (t < 0 || ths[t].stale_queued == 0) return t;
+      --ths[t].stale_queued;
+      --stale;
+    }
+  }
+
+  int pop_entry(ThreadTable& ths) {
     if (policy == SchedPolicy::MLFQ) {
       init_mlfq_if_needed();
       for (int lvl = 0; lvl < levels; ++lvl) {
-        if (!mlfq[lvl].empty()) { int t = mlfq[lvl].front(); mlfq[lvl].pop_front(); return t; }
+        if (!mlfq[lvl].empty()) return mlfq[lvl].pop_front(ths);
+      }
+      return -1;
+    } else if (policy == SchedPolicy::Custom) {
+      return ops->pop(custom);
+    } else if (policy == SchedPolicy::Priority) {
+      for (int p = MAX_PRIORITY; p > 0; --p) {
+        if (prio[p].empty()) continue;
+        int t = prio[p].pop_front(ths);
+        --prio_n;
+        // the list it came from is its boosted priority; running decays it
+        ths[t].dyn_priority = std::max(ths[t].base_priority, p - 1);
+        return t;
       }
       return -1;
     } else {
-      int t = rrq.front(); rrq.pop_front(); return t;
+      return rrq.empty() ? -1 : rrq.pop_front(ths);
     }
   }
 
-  void demote_mlfq(std::vector<Thread>& ths, int tid) {
-    if (policy != SchedPolicy::MLFQ) return;
+  // Policy hooks, called by the runtime for every policy.
+  void on_quantum_expired(ThreadTable& ths, int tid) {
+    if (policy == SchedPolicy::MLFQ) {
+      auto& th = ths[tid];
+      if (th.level_used >= allotment(level_of(th))) demote_mlfq(ths, tid);
+    }
+    else if (policy == SchedPolicy::Custom && ops->on_quantum_expired) ops->on_quantum_expired(custom, view(ths, tid));
+  }
+
+  // MLFQ keeps a blocking thread's level and allotment as they are: a thread
+  // that sleeps just before its quantum runs out must not keep (or regain) a
+  // high level that way. The periodic boost lifts genuinely starved ones.
+  void on_block(ThreadTable& ths, int tid) {
+    if (policy == SchedPolicy::Priority) ths[tid].dyn_priority = ths[tid].base_priority;
+    else if (policy == SchedPolicy::Custom && ops->on_block) ops->on_block(custom, view(ths, tid));
+  }
+
+  // Refill the thread_work budget of a thread about to run.
+  void on_dispatch(ThreadTable& ths, int tid) {
     auto& th = ths[tid];
-    th.mlfq_level = std::min(th.mlfq_level + 1, levels - 1);
-    th.quantum_budget = quantum_by_level[th.mlfq_level];
+    if (policy == SchedPolicy::MLFQ) {
+      int lvl = level_of(th);
+      th.quantum_budget = std::max(1, std::min(quantum_by_level[lvl], allotment(lvl) - th.level_used));
+      if (tuner.target_us) {
+        ++tuner.dispatches;
+        if (th.ready_since && tuner.samples.size() < MlfqTuner::MAX_SAMPLES)
+          tuner.samples.push_back(now_ms() - th.ready_since);
+        th.ready_since = 0;
+      }
+    } else if (policy == SchedPolicy::Custom && ops->quantum) th.quantum_budget = ops->quantum(custom, view(ths, tid));
+  }
+
+  // A blocked or sleeping thread became READY; at is when it was due (us).
+  void on_wakeup(Thread& th, int64_t at) {
+    if (tuner.target_us) th.ready_since = at;
   }
 
-  void promote_mlfq(std::vector<Thread>& ths, int tid) {
+  void on_pass(ThreadTable& ths, Logger& log) {
+    if (policy == SchedPolicy::MLFQ) { maybe_age(ths, log); maybe_tune(ths, log); }
+    else if (policy == SchedPolicy::Priority) age_priorities(ths, log);
+    else if (policy == SchedPolicy::Custom && ops->tick) ops->tick(custom);
+  }
+
+  void demote_mlfq(ThreadTable& ths, int tid) {
     if (policy != SchedPolicy::MLFQ) return;
     auto& th = ths[tid];
-    th.mlfq_level = std::max(th.mlfq_level - 1, 0);
-    th.quantum_budget = quantum_by_level[th.mlfq_level];
+    int& lvl = level_of(th);
+    lvl = std::min(lvl + 1, levels - 1);
+    th.level_used = 0;
   }
 
-  void maybe_age(std::vector<Thread>& ths) {
+  void maybe_age(ThreadTable& ths, Logger& log) {
     if (policy != SchedPolicy::MLFQ || !enable_aging) return;
     int64_t t = now_ms();
-    if (t - last_age_ms < aging_interval_ms) return;
+    if (t - last_age_ms < int64_t(aging_interval_ms) * 1000) return;
     last_age_ms = t;
-    // simple aging: move one thread from lowest non-empty queue up one level
-    for (int lvl = levels - 1; lvl > 0; --lvl) {
-      if (!mlfq[lvl].empty()) {
-        int tid = mlfq[lvl].front(); mlfq[lvl].pop_front();
-        ths[tid].mlfq_level = lvl - 1;
-        ths[tid].quantum_budget = quantum_by_level[ths[tid].mlfq_level];
-        mlfq[lvl - 1].push_back(tid);
-        g_log.log("age", tid, "promote");
-        break;
+    init_mlfq_if_needed();
+    size_t moved = 0;
+    for (int lvl = 1; lvl < levels; ++lvl) {
+      moved += mlfq[lvl].n;
+      mlfq[0].splice_back(ths, mlfq[lvl]);
+    }
+    ++boost_epoch;
+    log.log("boost", -1, std::to_string(moved));
+  }
+
+  void age_priorities(ThreadTable& ths, Logger& log) {
+    int64_t t = now_ms();
+    if (t - last_prio_age < int64_t(prio_age_interval_ms) * 1000) return;
+    last_prio_age = t;
+    size_t moved = prio_n - prio[MAX_PRIORITY].n;
+    if (!moved) return;
+    for (int p = MAX_PRIORITY - 1; p > 0; --p) prio[p + 1].splice_back(ths, prio[p]);
+    ++prio_ages;
+    log.log("age", -1, "prio " + std::to_string(moved));
+  }
+
+  void maybe_tune(ThreadTable& ths, Logger& log) {
+    auto& tn = tuner;
+    if (!tn.target_us) return;
+    int64_t t = now_ms();
+    if (t - tn.last_us < tn.period_us) return;
+    int64_t elapsed = std::max<int64_t>(1, t - tn.last_us);
+    tn.last_us = t;
+    int64_t p99 = 0;
+    if (!tn.samples.empty()) {
+      auto k = tn.samples.begin() + (tn.samples.size() * 99) / 100;
+      std::nth_element(tn.samples.begin(), k, tn.samples.end());
+      p99 = *k;
+    }
+    init_mlfq_if_needed();
+    const char* action = "hold";
+    if (p99 > tn.target_us) {
+      bool floor = true;
+      for (int& q : quantum_by_level) {
+        q = std::max(MlfqTuner::MIN_QUANTUM, q - std::max(1, q / 4));
+        floor = floor && q == MlfqTuner::MIN_QUANTUM;
+      }
+      aging_interval_ms = std::max(MlfqTuner::MIN_AGING_MS, aging_interval_ms * 3 / 4);
+      action = "shrink";
+      if (floor && levels < 8) { set_levels(ths, levels + 1); action = "add-level"; }
+    } else if (p99 * 2 < tn.target_us) {
+      bool cap = true;
+      for (int& q : quantum_by_level) {
+        q = std::min(MlfqTuner::MAX_QUANTUM, q + std::max(1, q / 4));
+        cap = cap && q == MlfqTuner::MAX_QUANTUM;
       }
+      aging_interval_ms = std::min(MlfqTuner::MAX_AGING_MS, aging_interval_ms + std::max(1, aging_interval_ms / 4));
+      action = "grow";
+      if (cap && levels > 2) { set_levels(ths, levels - 1); action = "drop-level"; }
     }
+    std::string q;
+    for (int v : quantum_by_level) q += (q.empty() ? "" : "/") + std::to_string(v);
+    log.log("tune", -1, std::string(action) + " p99_us=" + std::to_string(p99) +
+                        " samples=" + std::to_string(tn.samples.size()) +
+                        " units_per_s=" + std::to_string(tn.units * 1000000 / elapsed) +
+                        " dispatches=" + std::to_string(tn.dispatches) + " q=" + q +
+                        " levels=" + std::to_string(levels) + " aging_ms=" + std::to_string(aging_interval_ms));
+    tn.samples.clear();
+    tn.units = tn.dispatches = 0;
   }
 };
 
-static Scheduler g_sched;
+// ------------------------------ I/O (io_uring) ------------------------------
+//
+// green_* calls prepare an SQE tagged with the caller's tid and park it
+// BLOCKED. The scheduler hands all prepared SQEs to the kernel with one
+// io_uring_enter per scheduling pass and reaps the CQ ring (no syscall) in the
+// same place, so both directions are batched across threads.
+
+#if defined(__linux__)
+struct IoRing {
+  int fd = -1;
+  bool tried = false;
+  unsigned sq_entries = 0;
+  unsigned *sq_head = nullptr, *sq_tail = nullptr, *sq_mask = nullptr;
+  unsigned *sq_flags = nullptr, *sq_array = nullptr;
+  unsigned *cq_head = nullptr, *cq_tail = nullptr, *cq_mask = nullptr;
+  io_uring_sqe* sqes = nullptr;
+  io_uring_cqe* cqes = nullptr;
+  unsigned pending   = 0; // prepared, not yet submitted
+  unsigned inflight  = 0; // submitted, completion not yet reaped
+  size_t   pass_left = 0; // dispatches left before the current pass ends
+
+  void*  maps[3] = {};   // SQ ring, CQ ring (unless shared), SQE array
+  size_t map_sz[3] = {};
+
+  bool ok() const { return fd >= 0; }
+
+  ~IoRing() {
+    for (int i = 0; i < 3; ++i) if (maps[i]) munmap(maps[i], map_sz[i]);
+    if (fd >= 0) close(fd);
+  }
+
+  bool init(unsigned entries) {
+    tried = true;
+    io_uring_params p{};
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = entries * 64; // room for many parked pollers
+    int r = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (r < 0) return false;
+    size_t sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) sq_sz = cq_sz = std::max(sq_sz, cq_sz);
+    void* sq = mmap(nullptr, sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r, IORING_OFF_SQ_RING);
+    void* cq = single ? sq
+                      : mmap(nullptr, cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r, IORING_OFF_CQ_RING);
+    void* se = mmap(nullptr, p.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, r, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || se == MAP_FAILED) {
+      if (sq != MAP_FAILED) munmap(sq, sq_sz);
+      if (cq != MAP_FAILED && cq != sq) munmap(cq, cq_sz);
+      if (se != MAP_FAILED) munmap(se, p.sq_entries * sizeof(io_uring_sqe));
+      close(r);
+      return false;
+    }
+    maps[0] = sq; map_sz[0] = sq_sz;
+    if (!single) { maps[1] = cq; map_sz[1] = cq_sz; }
+    maps[2] = se; map_sz[2] = p.sq_entries * sizeof(io_uring_sqe);
+    char* sqc = (char*)sq;
+    char* cqc = (char*)cq;
+    sq_head  = (unsigned*)(sqc + p.sq_off.head);
+    sq_tail  = (unsigned*)(sqc + p.sq_off.tail);
+    sq_mask  = (unsigned*)(sqc + p.sq_off.ring_mask);
+    sq_flags = (unsigned*)(sqc + p.sq_off.flags);
+    sq_array = (unsigned*)(sqc + p.sq_off.array);
+    cq_head  = (unsigned*)(cqc + p.cq_off.head);
+    cq_tail  = (unsigned*)(cqc + p.cq_off.tail);
+    cq_mask  = (unsigned*)(cqc + p.cq_off.ring_mask);
+    cqes     = (io_uring_cqe*)(cqc + p.cq_off.cqes);
+    sqes     = (io_uring_sqe*)se;
+    sq_entries = p.sq_entries;
+    fd = r;
+    return true;
+  }
+
+  int enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+    int r;
+    do r = (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+    while (r < 0 && errno == EINTR);
+    return r;
+  }
+
+  // The kernel only reads the SQ ring inside io_uring_enter (no SQPOLL), so
+  // the tail can be published before the caller fills the entry.
+  io_uring_sqe* get_sqe() {
+    unsigned head = std::atomic_ref<unsigned>(*sq_head).load(std::memory_order_acquire);
+    unsigned tail = *sq_tail;
+    if (tail - head >= sq_entries) return nullptr;
+    unsigned idx = tail & *sq_mask;
+    io_uring_sqe* sqe = &sqes[idx];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array[idx] = idx;
+    std::atomic_ref<unsigned>(*sq_tail).store(tail + 1, std::memory_order_release);
+    ++pending;
+    return sqe;
+  }
+
+  bool cq_ready() const {
+    return std::atomic_ref<unsigned>(*cq_tail).load(std::memory_order_acquire) != *cq_head;
+  }
 
-// ------------------------------ Runtime -------------------------------------
+  void submit() {
+    if (!pending) return;
+    int r = enter(pending, 0, 0);
+    if (r > 0) { pending -= (unsigned)r; inflight += (unsigned)r; }
+  }
 
-static std::vector<Thread> g_threads;
-static std::atomic<int>    g_current{-1};
-static std::atomic<bool>   g_stop{false};
-static int                 g_next_tid = 0;
+  template <class F>
+  void reap(F&& on_complete) {
+    for (;;) {
+      unsigned head = *cq_head;
+      unsigned tail = std::atomic_ref<unsigned>(*cq_tail).load(std::memory_order_acquire);
+      for (; head != tail; ++head) {
+        const io_uring_cqe& c = cqes[head & *cq_mask];
+        --inflight;
+        on_complete(c.user_data, c.res);
+      }
+      std::atomic_ref<unsigned>(*cq_head).store(head, std::memory_order_release);
+      // Completions the kernel could not fit are flushed by a GETEVENTS enter.
+      if (!(std::atomic_ref<unsigned>(*sq_flags).load(std::memory_order_relaxed) & IORING_SQ_CQ_OVERFLOW)) break;
+      enter(0, 0, IORING_ENTER_GETEVENTS);
+    }
+  }
+};
+constexpr unsigned IO_RING_ENTRIES = 256;
+#endif
+
+// ------------------------------ Idle wait -----------------------------------
+//
+// When nothing is runnable the loop blocks in a single epoll_wait covering the
+// next sleeper deadline (timerfd, absolute CLOCK_MONOTONIC, microsecond
+// resolution), io_uring completions (the ring fd polls readable while CQEs are
+// pending) and cross-thread notifications (eventfd).
+
+#if defined(__linux__)
+struct Waiter {
+  enum : uint64_t { TAG_TIMER, TAG_EVENT, TAG_RING };
+  int ep  = -1;
+  int tfd = -1;
+  std::atomic<int> efd{-1};
+  bool tried = false;
+  bool ring_added = false;
+  int64_t armed = -1; // deadline currently programmed into the timerfd
+
+  bool add(int fd, uint64_t tag) {
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.u64 = tag;
+    return epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) == 0;
+  }
+
+  ~Waiter() {
+    for (int fd : {ep, tfd, efd.load()}) if (fd >= 0) close(fd);
+  }
+
+  bool init() {
+    if (tried) return ep >= 0;
+    tried = true;
+    int e = epoll_create1(EPOLL_CLOEXEC);
+    int t = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    int v = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ep = e; tfd = t;
+    if (e < 0 || t < 0 || v < 0 || !add(t, TAG_TIMER) || !add(v, TAG_EVENT)) {
+      for (int fd : {e, t, v}) if (fd >= 0) close(fd);
+      ep = tfd = -1;
+      return false;
+    }
+    efd.store(v, std::memory_order_release);
+    return true;
+  }
+
+  // Safe from any OS thread.
+  void notify() {
+    int fd = efd.load(std::memory_order_acquire);
+    if (fd < 0) return;
+    uint64_t one = 1;
+    (void)!::write(fd, &one, sizeof(one));
+  }
+
+  // deadline_us < 0: no timed wakeup needed.
+  void wait(const IoRing& io, int64_t deadline_us) {
+    if (io.ok() && !ring_added) ring_added = add(io.fd, TAG_RING);
+    if (deadline_us != armed) {
+      itimerspec its{}; // all zero disarms
+      if (deadline_us >= 0) {
+        its.it_value.tv_sec  = deadline_us / 1000000;
+        its.it_value.tv_nsec = (deadline_us % 1000000) * 1000 + 1;
+      }
+      timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, nullptr);
+      armed = deadline_us;
+    }
+    epoll_event evs[3];
+    int n = epoll_wait(ep, evs, 3, -1);
+    uint64_t drain;
+    for (int i = 0; i < n; ++i) {
+      if (evs[i].data.u64 == TAG_TIMER) { (void)!::read(tfd, &drain, sizeof(drain)); armed = -1; }
+      else if (evs[i].data.u64 == TAG_EVENT) (void)!::read(efd.load(), &drain, sizeof(drain));
+    }
+  }
+};
+#endif
+
+// ------------------------------ Cross-thread wakeups ------------------------
+
+// Signals posted by other OS threads, and tids whose offloaded job finished,
+// applied by the scheduler on its next pass.
+struct RemoteInbox {
+  std::mutex mu;
+  std::vector<std::string> signals;
+  std::vector<int> wakes;
+  std::atomic<bool> pending{false};
+};
+
+// ------------------------------ Runtime state -------------------------------
+
+// Everything one scheduler owns. The free functions act on the calling OS
+// thread's current runtime, so runtimes on different OS threads share nothing.
+struct Runtime::Impl {
+  Logger      log;
+  ThreadTable threads;
+  Scheduler   sched;
+  int         current = -1; // running tid, -1 in the main context
+  int         handoff = -1; // READY tid to dispatch before the run queue
+  int         picked = -1;  // tid a leaving thread took off the queue for the loop
+  std::vector<int> scan_out; // tids found by the wakeup / NEW scans, reused
+  int         next_tid = 0;
+
+  // Bookkeeping that lets the loop skip whole-table scans: threads not yet
+  // FINISHED, threads still NEW, and the earliest sleeper deadline.
+  int         live = 0;
+  int         new_pending = 0;
+  int64_t     next_wake = INT64_MAX;
+
+  std::map<std::string, WaitQueue> resources; // named resource -> wait queue
+  std::unordered_map<int, std::unordered_map<std::string, std::intptr_t>> tls;
+  TlsSlots                main_tls;    // used outside green threads
+  std::vector<LocalValue> main_locals; // GreenLocal values of the main context
+  Arena                   main_arena;  // thread_alloc outside green threads
+  RemoteInbox inbox;
+  int         idle_spin_us = 0;  // idle strategy, see idle_wait
+  int         idle_yield_us = 0;
+  IdleStats   idle{};
+
+#if defined(_WIN32)
+  LPVOID      main_fiber = nullptr;
+#else
+  ucontext_t  sched_ctx{};
+#endif
+#if defined(__linux__)
+  IoRing      io;
+  Waiter      waiter;
+#endif
+
+  explicit Impl(const std::string& log_path) : log(log_path) {}
+  ~Impl() {
+    for (auto& l : main_locals) if (l.obj) l.dtor(l.obj);
+  }
+};
+
+static thread_local Runtime::Impl* t_rt = nullptr;
+
+// Used by OS threads that never made a runtime current: the process-wide
+// runtime the free functions have always driven.
+static Runtime::Impl& default_runtime() {
+  static Runtime::Impl rt("schedule_log.csv");
+  return rt;
+}
+
+static Runtime::Impl& rt() {
+  if (!t_rt) [[unlikely]] t_rt = &default_runtime();
+  return *t_rt;
+}
+
+Runtime::Runtime(const std::string& log_path) : impl_(std::make_unique<Impl>(log_path)) {}
+Runtime::~Runtime() = default;
+
+Runtime::Scope::Scope(Runtime& r) : prev_(t_rt) { t_rt = r.impl_.get(); }
+Runtime::Scope::~Scope() { t_rt = prev_; }
+
+void Runtime::run() {
+  Scope scope(*this);
+  thread_run();
+}
+
+// The eventfd is written under the lock: once the runtime has drained the
+// inbox it may finish and close it.
+static void inbox_post(Runtime::Impl& r, const std::string* signal, int tid) {
+  std::lock_guard<std::mutex> lk(r.inbox.mu);
+  if (signal) r.inbox.signals.push_back(*signal);
+  else r.inbox.wakes.push_back(tid);
+  r.inbox.pending.store(true, std::memory_order_release);
+#if defined(__linux__)
+  r.waiter.notify();
+#endif
+}
+
+void Runtime::notify(const std::string& resource) { inbox_post(*impl_, &resource, -1); }
+
+// ------------------------------ Offload pool --------------------------------
+//
+// Helper OS threads that run unavoidable blocking calls for parked green
+// threads, so fsync or a large read stalls only its caller.
+
+struct OffloadPool {
+  struct Job { std::function<void()> fn; Runtime::Impl* rt; int tid; };
+  std::mutex mu;
+  std::condition_variable cv;
+  std::deque<Job> jobs;
+  std::vector<std::thread> workers;
+  int  size = 4;
+  int  idle = 0;
+  bool stopping = false;
+
+  void worker() {
+    for (;;) {
+      Job job;
+      {
+        std::unique_lock<std::mutex> lk(mu);
+        ++idle;
+        cv.wait(lk, [&]{ return stopping || !jobs.empty(); });
+        --idle;
+        if (jobs.empty()) return;
+        job = std::move(jobs.front());
+        jobs.pop_front();
+      }
+      job.fn();
+      inbox_post(*job.rt, nullptr, job.tid);
+    }
+  }
+
+  void submit(std::function<void()> fn, Runtime::Impl* rt, int tid) {
+    {
+      std::lock_guard<std::mutex> lk(mu);
+      jobs.push_back({std::move(fn), rt, tid});
+      // grow lazily: a new helper only when every existing one is busy
+      if ((int)workers.size() < size && (int)jobs.size() > idle)
+        workers.emplace_back([this]{ worker(); });
+    }
+    cv.notify_one();
+  }
+
+  ~OffloadPool() {
+    { std::lock_guard<std::mutex> lk(mu); stopping = true; }
+    cv.notify_all();
+    for (auto& w : workers) w.join();
+  }
+};
+static OffloadPool g_offload;
 
 // Forward decls
 static void schedule();
-static void platform_yield_to_scheduler();
+static void switch_out();
 static void switch_to_thread(int next_tid);
+static void check_stackful();
+#if defined(__linux__)
+static void io_cancel(int tid);
+#endif
 
 // API ------------------------------------------------------------------------
 
-int  thread_create(const ThreadFunc& func, const std::string& name, int priority) {
-  int tid = g_next_tid++;
-  Thread t;
-  t.tid = tid;
-  t.func = func;
+static void init_thread(Thread& t, const std::string& name, int priority) {
+  t.tid = rt().next_tid++;
   t.name = name;
   t.base_priority = std::clamp(priority, 1, 10);
   t.dyn_priority = t.base_priority;
-  t.state = ThreadState::NEW;
+  ++rt().live;
+}
+
+static Thread& add_thread(const std::string& name, int priority) {
+  Thread& t = rt().threads.emplace_back();
+  init_thread(t, name, priority);
+  ++rt().new_pending;
+  return t;
+}
+
+// The callable is placed at the top of the new thread's stack, which is
+// allocated anyway, so spawning costs no extra allocation. Fiber stacks are not
+// ours, and very large captures would eat the stack; those go to the heap.
+static void* place_callable(Thread& t, char* stack, size_t size, size_t align) {
+  align = std::max<size_t>(align, 16);
+  t.fn_size = size;
 #if !defined(_WIN32)
-  t.cx.stack = std::make_unique<char[]>(STACK_SIZE);
+  t.cx.stack = stack;
+  if (size <= STACK_SIZE / 4) {
+    uintptr_t base = (uintptr_t)stack;
+    uintptr_t obj  = (base + STACK_SIZE - size) & ~(uintptr_t)(align - 1);
+    t.fn_obj    = (void*)obj;
+    t.cx.usable = (obj - base) & ~(uintptr_t)15;
+    return t.fn_obj;
+  }
 #endif
-  g_threads.push_back(std::move(t));
-  return tid;
+  t.fn_obj = ::operator new(size, std::align_val_t(align));
+  t.fn_heap_align = align;
+  return t.fn_obj;
+}
+
+namespace detail {
+SpawnSlot thread_reserve(std::size_t size, std::size_t align, const std::string& name, int priority) {
+  Thread& t = add_thread(name, priority);
+  char* stack = STACK_SIZE ? rt().threads.alloc_stacks(1) : nullptr;
+  return {t.tid, place_callable(t, stack, size, align)};
+}
+
+// count threads from one record slab and one stack block, each with a
+// size/align callable slot; they start READY and are queued as one batch by
+// thread_commit_n, skipping the NEW sweep.
+int thread_reserve_n(int count, std::size_t size, std::size_t align, const std::string& name, int priority) {
+  Thread* first = rt().threads.emplace_n((size_t)count);
+  char* stacks = STACK_SIZE ? rt().threads.alloc_stacks((size_t)count) : nullptr;
+  for (int i = 0; i < count; ++i) {
+    init_thread(first[i], name, priority);
+    place_callable(first[i], stacks ? stacks + (size_t)i * STACK_SIZE : nullptr, size, align);
+  }
+  return first->tid;
+}
+
+void* thread_storage(int tid) { return rt().threads[tid].fn_obj; }
+
+void thread_commit_n(int first, int count, void (*invoke)(void*), void (*destroy)(void*)) {
+  auto& r = rt();
+  for (int tid = first; tid < first + count; ++tid) {
+    auto& th = r.threads[tid];
+    th.invoke  = invoke;
+    th.destroy = destroy;
+    r.threads.state(tid) = ThreadState::READY;
+  }
+  r.sched.enqueue_range(r.threads, first, count);
+  r.log.log("ready", first, "batch " + std::to_string(count));
+}
+
+void thread_commit(int tid, void (*invoke)(void*), void (*destroy)(void*)) {
+  rt().threads[tid].invoke  = invoke;
+  rt().threads[tid].destroy = destroy;
+}
+
+// The callable's constructor threw: retire the reserved record.
+void thread_abandon(int tid) {
+  auto& r = rt();
+  auto& th = r.threads[tid];
+  if (th.fn_heap_align) ::operator delete(th.fn_obj, std::align_val_t(th.fn_heap_align));
+  th.fn_obj = nullptr;
+  r.threads.state(tid) = ThreadState::FINISHED;
+  --r.live;
+  --r.new_pending;
+}
+} // namespace detail
+
+int  thread_create(const ThreadFunc& func, const std::string& name, int priority) {
+  return thread_spawn(func, name, priority);
+}
+
+static std::vector<LocalValue>& current_locals() {
+  auto& r = rt();
+  int tid = r.current;
+  return tid >= 0 ? r.threads[tid].locals : r.main_locals;
+}
+
+namespace detail {
+int green_local_key() { return g_local_keys.fetch_add(1, std::memory_order_relaxed); }
+
+void* green_local_find(int key) {
+  auto& v = current_locals();
+  return (size_t)key < v.size() ? v[key].obj : nullptr;
+}
+
+void green_local_store(int key, void* obj, void (*dtor)(void*), std::size_t size) {
+  auto& v = current_locals();
+  if ((size_t)key >= v.size()) v.resize(key + 1);
+  v[key] = {obj, dtor, size};
+}
+} // namespace detail
+
+static Arena& current_arena() {
+  auto& r = rt();
+  int tid = r.current;
+  return tid >= 0 ? r.threads[tid].arena : r.main_arena;
+}
+
+void* thread_alloc(std::size_t size, std::size_t align) {
+  if (align == 0 || (align & (align - 1))) {
+    std::fprintf(stderr, "thread_alloc: alignment %zu is not a power of two\n", align);
+    std::exit(1);
+  }
+  return current_arena().alloc(size, align);
+}
+
+std::pmr::memory_resource* thread_memory_resource() { return &current_arena(); }
+
+// Still on the finishing thread (so destructors may use TLS and the thread_*
+// API): destroy its GreenLocal values newest-first, drop its TLS and arena,
+// then retire it.
+static void finish_thread(int tid) {
+  auto& r = rt();
+  auto& th = r.threads[tid];
+  std::vector<LocalValue> locals;
+  locals.swap(th.locals);
+  for (auto it = locals.rbegin(); it != locals.rend(); ++it) {
+    if (it->obj) it->dtor(it->obj);
+  }
+  r.tls.erase(tid);
+  th.tls = {};
+  th.arena.release(); // after the GreenLocal destructors, which may use it
+  r.threads.state(tid) = ThreadState::FINISHED;
+  --r.live;
+  r.log.log("finish", tid);
+}
+
+// Runs on the thread's own stack; the callable is destroyed as soon as it
+// returns so its captures are released when the thread finishes.
+static void run_callable(Thread& th) {
+  th.invoke(th.fn_obj);
+  th.destroy(th.fn_obj);
+  if (th.fn_heap_align) ::operator delete(th.fn_obj, std::align_val_t(th.fn_heap_align));
+  th.fn_obj = nullptr;
+}
+
+static const char* policy_name(SchedPolicy p) {
+  switch (p) {
+    case SchedPolicy::Priority: return "prio";
+    case SchedPolicy::MLFQ:     return "mlfq";
+    case SchedPolicy::Custom:   return "custom";
+    default:                    return "rr";
+  }
 }
 
-void set_policy(SchedPolicy p) { g_sched.policy = p; }
+// Safe while thread_run is active: queued threads migrate to the new
+// structures before anything else is dispatched.
+void set_policy(SchedPolicy p) {
+  auto& r = rt();
+  if (p == r.sched.policy || p == SchedPolicy::Custom) return;
+  r.sched.switch_policy(r.threads, p);
+  r.log.log("policy", r.current, std::string(policy_name(p)) + " ready=" + std::to_string(r.sched.size()));
+}
+
+namespace detail {
+void install_policy(void* policy, const PolicyOps& ops) {
+  auto& r = rt();
+  r.sched.install(r.threads, policy, ops);
+  r.log.log("policy", r.current, "custom ready=" + std::to_string(r.sched.size()));
+}
+} // namespace detail
 
 void mlfq_set_levels(int levels) {
-  g_sched.levels = std::clamp(levels, 1, 8);
+  auto& r = rt();
+  r.sched.set_levels(r.threads, std::clamp(levels, 1, 8));
 }
 void mlfq_set_quantum_by_level(int level, int quantum_units) {
+  auto& r = rt();
+  if (level < 0) return;
+  if ((int)r.sched.quantum_by_level.size() <= level)
+    r.sched.quantum_by_level.resize(level+1, 2);
+  r.sched.quantum_by_level[level] = std::max(1, quantum_units);
+}
+void mlfq_set_allotment_by_level(int level, int units) {
+  auto& r = rt();
   if (level < 0) return;
-  if ((int)g_sched.quantum_by_level.size() <= level)
-    g_sched.quantum_by_level.resize(level+1, 2);
-  g_sched.quantum_by_level[level] = std::max(1, quantum_units);
+  if ((int)r.sched.allotment_by_level.size() <= level)
+    r.sched.allotment_by_level.resize(level+1, 0);
+  r.sched.allotment_by_level[level] = std::max(1, units);
+}
+void mlfq_autotune(int target_p99_us, int period_ms) {
+  auto& tn = rt().sched.tuner;
+  tn.target_us = std::max(0, target_p99_us);
+  tn.period_us = int64_t(std::max(1, period_ms)) * 1000;
+  tn.last_us = now_ms();
+  tn.samples.clear();
+  tn.units = tn.dispatches = 0;
 }
-void mlfq_enable_aging(bool enable) { g_sched.enable_aging = enable; }
-void mlfq_set_aging_interval_ms(int ms) { g_sched.aging_interval_ms = std::max(1, ms); }
+void prio_set_aging_interval_ms(int ms) { rt().sched.prio_age_interval_ms = std::max(1, ms); }
+void mlfq_enable_aging(bool enable) { rt().sched.enable_aging = enable; }
+void mlfq_set_aging_interval_ms(int ms) { rt().sched.aging_interval_ms = std::max(1, ms); }
 
 void tls_set(const std::string& key, std::intptr_t value) {
-  int tid = g_current.load();
-  g_tls[tid][key] = value;
+  int tid = rt().current;
+  rt().tls[tid][key] = value;
+}
+int tls_key_create(const std::string& name) {
+  std::lock_guard<std::mutex> lk(g_tls_keys_mu);
+  for (size_t i = 0; i < g_tls_keys.size(); ++i) {
+    if (g_tls_keys[i] == name) return (int)i;
+  }
+  if (g_tls_keys.size() >= (size_t)TLS_SLOTS) return -1;
+  g_tls_keys.push_back(name);
+  return (int)g_tls_keys.size() - 1;
 }
+
+static TlsSlots& current_tls() {
+  auto& r = rt();
+  int tid = r.current;
+  return tid >= 0 ? r.threads[tid].tls : r.main_tls;
+}
+
+void tls_slot_set(int slot, std::intptr_t value) {
+  if ((unsigned)slot >= (unsigned)TLS_SLOTS) return;
+  TlsSlots& t = current_tls();
+  t.value[slot] = value;
+  t.present |= 1u << slot;
+}
+
+std::optional<std::intptr_t> tls_slot_get(int slot) {
+  if ((unsigned)slot >= (unsigned)TLS_SLOTS) return std::nullopt;
+  const TlsSlots& t = current_tls();
+  if (!(t.present & (1u << slot))) return std::nullopt;
+  return t.value[slot];
+}
+
 std::optional<std::intptr_t> tls_get(const std::string& key) {
-  int tid = g_current.load();
-  auto itT = g_tls.find(tid);
-  if (itT == g_tls.end()) return std::nullopt;
+  auto& r = rt();
+  int tid = r.current;
+  auto itT = r.tls.find(tid);
+  if (itT == r.tls.end()) return std::nullopt;
   auto it = itT->second.find(key);
   if (it == itT->second.end()) return std::nullopt;
   return it->second;
 }
 
-void thread_sleep(int ms) {
-  int tid = g_current.load();
-  auto& th = g_threads[tid];
-  th.wake_time_ms = now_ms() + ms;
-  th.state = ThreadState::SLEEPING;
-  g_log.log("sleep", tid, std::to_string(ms));
-  if (g_sched.policy == SchedPolicy::MLFQ) {
-    // I/O or sleep considered interactive -> promote a level
-    g_sched.promote_mlfq(g_threads, tid);
-  }
-  platform_yield_to_scheduler();
+static void make_ready(int tid, const char* event, const std::string& info = "") {
+  auto& r = rt();
+  auto& th = r.threads[tid];
+  r.threads.state(tid) = ThreadState::READY;
+  th.block = BlockKind::None;
+  r.sched.on_wakeup(th, r.sched.tuner.target_us ? now_ms() : 0);
+  r.sched.enqueue(r.threads, tid);
+  r.log.log(event, tid, info);
+}
+
+static bool cancelled_now() {
+  int tid = rt().current;
+  return tid >= 0 && rt().threads[tid].cancel_requested;
+}
+
+// The begin_* helpers change the running thread's state; stackful callers then
+// switch away, stackless tasks return from await_suspend.
+static void begin_sleep(int tid, int ms) {
+  auto& r = rt();
+  int64_t& wake = r.threads.wake_time(tid);
+  wake = now_ms() + int64_t(ms) * 1000; // now_ms() ticks in microseconds
+  r.next_wake = std::min(r.next_wake, wake);
+  r.threads.state(tid) = ThreadState::SLEEPING;
+  r.log.log("sleep", tid, std::to_string(ms));
+  r.sched.on_block(r.threads, tid);
+}
+
+static void begin_wait(int tid, const std::string& resource) {
+  auto& r = rt();
+  auto& th = r.threads[tid];
+  r.threads.state(tid) = ThreadState::BLOCKED;
+  r.sched.on_block(r.threads, tid);
+  WaitQueue& wq = r.resources[resource];
+  wq.push(tid);
+  th.block = BlockKind::Resource;
+  th.waiting_on = &wq;
+  r.log.log("wait", tid, resource);
 }
 
-void thread_wait(const std::string& resource) {
-  int tid = g_current.load();
-  auto& th = g_threads[tid];
-  th.state = ThreadState::BLOCKED;
-  g_resources[resource].push(tid);
-  g_log.log("wait", tid, resource);
-  if (g_sched.policy == SchedPolicy::MLFQ) {
-    g_sched.promote_mlfq(g_threads, tid);
+static void begin_yield(int tid) {
+  auto& r = rt();
+  if (r.threads.state(tid) == ThreadState::RUNNING) {
+    r.threads.state(tid) = ThreadState::READY;
+    r.sched.enqueue(r.threads, tid);
+    r.log.log("yield", tid);
   }
-  platform_yield_to_scheduler();
 }
 
-void thread_signal(const std::string& resource) {
-  auto it = g_resources.find(resource);
-  if (it == g_resources.end() || it->second.empty()) return;
+bool thread_sleep(int ms) {
+  if (cancelled_now()) return false;
+  begin_sleep(rt().current, ms);
+  switch_out();
+  return !cancelled_now();
+}
+
+// Block the running thread until something else makes it READY. start() runs
+// after the thread is marked BLOCKED, so a completion it triggers sees it parked.
+template <class Start>
+static void park_blocked(int tid, BlockKind kind, Start&& start) {
+  auto& r = rt();
+  auto& th = r.threads[tid];
+  r.threads.state(tid) = ThreadState::BLOCKED;
+  th.block = kind;
+  r.sched.on_block(r.threads, tid);
+  start();
+  switch_out();
+}
+
+bool thread_wait(const std::string& resource) {
+  if (cancelled_now()) return false;
+  begin_wait(rt().current, resource);
+  switch_out();
+  return !cancelled_now();
+}
+
+void thread_signal(const std::string& resource, bool handoff) {
+  auto& r = rt();
+  auto it = r.resources.find(resource);
+  if (it == r.resources.end() || it->second.empty()) return;
   int tid = it->second.pop();
-  auto& th = g_threads[tid];
-  if (th.state == ThreadState::BLOCKED) {
-    th.state = ThreadState::READY;
-    g_sched.enqueue(g_threads, tid);
-    g_log.log("signal", tid, resource);
+  auto& th = r.threads[tid];
+  if (r.threads.state(tid) == ThreadState::BLOCKED) {
+    th.waiting_on = nullptr;
+    make_ready(tid, "signal", resource);
+    if (!handoff || r.current < 0) return;
+    if (r.threads[r.current].coro_root) r.handoff = tid; // runs once the task suspends
+    else thread_yield_to(tid);
+  }
+}
+
+void thread_cancel(int tid) {
+  auto& r = rt();
+  if (tid < 0 || tid >= (int)r.threads.size()) return;
+  auto& th = r.threads[tid];
+  ThreadState st = r.threads.state(tid);
+  if (st == ThreadState::FINISHED || th.cancel_requested) return;
+  th.cancel_requested = true;
+  r.log.log("cancel", tid);
+  if (st == ThreadState::SLEEPING) {
+    make_ready(tid, "wakeup", "cancel");
+  } else if (st == ThreadState::BLOCKED) {
+    switch (th.block) {
+      case BlockKind::Resource:
+        th.waiting_on->remove(tid);
+        th.waiting_on = nullptr;
+        make_ready(tid, "wakeup", "cancel");
+        break;
+      case BlockKind::Park:
+        make_ready(tid, "wakeup", "cancel");
+        break;
+      case BlockKind::Io:
+#if defined(__linux__)
+        io_cancel(tid);
+#endif
+        break;
+      default:
+        break;
+    }
   }
 }
 
+bool thread_cancelled() { return cancelled_now(); }
+
+void thread_notify(const std::string& resource) { inbox_post(rt(), &resource, -1); }
+
+static void drain_inbox() {
+  if (!rt().inbox.pending.load(std::memory_order_acquire)) return;
+  std::vector<std::string> sigs;
+  std::vector<int> wakes;
+  {
+    std::lock_guard<std::mutex> lk(rt().inbox.mu);
+    sigs.swap(rt().inbox.signals);
+    wakes.swap(rt().inbox.wakes);
+    rt().inbox.pending.store(false, std::memory_order_relaxed);
+  }
+  for (auto& r : sigs) thread_signal(r);
+  for (int tid : wakes) {
+    if (rt().threads.state(tid) == ThreadState::BLOCKED) make_ready(tid, "offdone");
+  }
+}
+
+void offload_set_threads(int n) {
+  std::lock_guard<std::mutex> lk(g_offload.mu);
+  g_offload.size = std::clamp(n, 1, 256);
+}
+
+namespace detail {
+void offload_run(std::function<void()> job) {
+  int tid = rt().current;
+  if (tid < 0) { job(); return; }
+  park_blocked(tid, BlockKind::Uncancellable, [&]{
+    rt().log.log("offload", tid);
+    g_offload.submit(std::move(job), &rt(), tid);
+  });
+}
+} // namespace detail
+
 // Work units: decrement quantum; if <=0, auto-yield (and demote for MLFQ)
 int thread_work(int units) {
-  int tid = g_current.load();
-  auto& th = g_threads[tid];
-  th.quantum_budget -= std::max(1, units);
+  auto& r = rt();
+  int tid = r.current;
+  auto& th = r.threads[tid];
+  units = std::max(1, units);
+  th.quantum_budget -= units;
+  th.level_used += units; // MLFQ allotment, kept across yields and sleeps
+  r.sched.tuner.units += units;
   if (th.quantum_budget <= 0) {
-    g_log.log("qexpire", tid, "auto-yield");
-    // Demote in MLFQ if CPU-bound
-    if (g_sched.policy == SchedPolicy::MLFQ) {
-      g_sched.demote_mlfq(g_threads, tid);
-    }
+    r.log.log("qexpire", tid, "auto-yield");
+    // CPU-bound: MLFQ demotes once the level's allotment is used up
+    r.sched.on_quantum_expired(r.threads, tid);
     // requeue and yield
-    if (th.state == ThreadState::RUNNING) {
-      th.state = ThreadState::READY;
-      g_sched.enqueue(g_threads, tid);
+    if (r.threads.state(tid) == ThreadState::RUNNING) {
+      r.threads.state(tid) = ThreadState::READY;
+      r.sched.enqueue(r.threads, tid);
     }
-    platform_yield_to_scheduler();
+    switch_out();
   }
   return th.quantum_budget;
 }
 
+#if !defined(_WIN32)
+
+#if defined(__linux__)
+// Queue an operation for the current green thread. Returns null when there is
+// no green thread to park or io_uring is unavailable; callers then fall back
+// to the plain syscall.
+static io_uring_sqe* io_prepare(uint8_t op, int fd, uint64_t addr, uint32_t len, uint64_t off, const char* what) {
+  auto& r = rt();
+  int tid = r.current;
+  if (tid < 0) return nullptr;
+  if (!r.io.tried) {
+    r.log.log("io", -1, r.io.init(IO_RING_ENTRIES) ? "io_uring" : "sync");
+  }
+  if (!r.io.ok()) return nullptr;
+  io_uring_sqe* sqe = r.io.get_sqe();
+  if (!sqe) { r.io.submit(); sqe = r.io.get_sqe(); }
+  if (!sqe) return nullptr;
+  sqe->opcode    = op;
+  sqe->fd        = fd;
+  sqe->addr      = addr;
+  sqe->len       = len;
+  sqe->off       = off;
+  sqe->user_data = (uint64_t)tid;
+  r.log.log("io", tid, what);
+  return sqe;
+}
+
+// Park until the scheduler delivers the CQE; returns its result (-errno on failure).
+static int64_t io_park() {
+  int tid = rt().current;
+  park_blocked(tid, BlockKind::Io, []{});
+  return rt().threads[tid].io_result;
+}
+
+// user_data of ASYNC_CANCEL requests; their own completions are ignored.
+constexpr uint64_t IO_CANCEL_TAG = 1ull << 63;
+
+static void io_complete(uint64_t user_data, int res) {
+  if (user_data & IO_CANCEL_TAG) return;
+  int tid = (int)user_data;
+  auto& th = rt().threads[tid];
+  th.io_result = res;
+  if (rt().threads.state(tid) == ThreadState::BLOCKED) make_ready(tid, "iodone", std::to_string(res));
+}
+
+// The parked operation completes with -ECANCELED (or its real result if it
+// raced), which wakes the thread as usual.
+static void io_cancel(int tid) {
+  auto& r = rt();
+  io_uring_sqe* sqe = r.io.get_sqe();
+  if (!sqe) { r.io.submit(); sqe = r.io.get_sqe(); }
+  if (!sqe) return;
+  sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+  sqe->addr      = (uint64_t)tid;
+  sqe->user_data = (uint64_t)tid | IO_CANCEL_TAG;
+}
+
+static int64_t io_result(int64_t res) {
+  if (res < 0) { errno = (int)-res; return -1; }
+  return res;
+}
+#endif
+
+int64_t green_read(int fd, void* buf, std::size_t len, int64_t offset) {
+  if (cancelled_now()) { errno = ECANCELED; return -1; }
+#if defined(__linux__)
+  if (io_prepare(IORING_OP_READ, fd, (uint64_t)(uintptr_t)buf, (uint32_t)std::min<std::size_t>(len, UINT32_MAX),
+                 (uint64_t)offset, "read"))
+    return io_result(io_park());
+#endif
+  return offset < 0 ? ::read(fd, buf, len) : ::pread(fd, buf, len, offset);
+}
+
+int64_t green_write(int fd, const void* buf, std::size_t len, int64_t offset) {
+  if (cancelled_now()) { errno = ECANCELED; return -1; }
+#if defined(__linux__)
+  if (io_prepare(IORING_OP_WRITE, fd, (uint64_t)(uintptr_t)buf, (uint32_t)std::min<std::size_t>(len, UINT32_MAX),
+                 (uint64_t)offset, "write"))
+    return io_result(io_park());
+#endif
+  return offset < 0 ? ::write(fd, buf, len) : ::pwrite(fd, buf, len, offset);
+}
+
+int green_accept(int fd, sockaddr* addr, socklen_t* addrlen) {
+  if (cancelled_now()) { errno = ECANCELED; return -1; }
+#if defined(__linux__)
+  // ACCEPT takes the socklen_t* in the off/addr2 slot.
+  if (io_prepare(IORING_OP_ACCEPT, fd, (uint64_t)(uintptr_t)addr, 0, (uint64_t)(uintptr_t)addrlen, "accept"))
+    return (int)io_result(io_park());
+#endif
+  return ::accept(fd, addr, addrlen);
+}
+
+// ------------------------------ Sockets -------------------------------------
+//
+// Readiness-based wrappers: try the call non-blocking and, on EAGAIN, park the
+// green thread until the fd polls ready (io_uring POLL_ADD on Linux).
+
+// Park until fd reports one of events. Returns the ready mask, -1 with errno.
+static int wait_fd(int fd, short events) {
+  if (cancelled_now()) { errno = ECANCELED; return -1; }
+#if defined(__linux__)
+  if (io_uring_sqe* sqe = io_prepare(IORING_OP_POLL_ADD, fd, 0, 0, 0, "poll")) {
+    sqe->poll32_events = (uint32_t)events;
+    return (int)io_result(io_park());
+  }
+#endif
+  pollfd p{fd, events, 0};
+  if (rt().current < 0) return ::poll(&p, 1, -1) < 0 ? -1 : p.revents;
+  for (;;) {
+    int r = ::poll(&p, 1, 0);
+    if (r != 0) return r < 0 ? -1 : p.revents;
+    if (!thread_sleep(1)) { errno = ECANCELED; return -1; }
+  }
+}
+
+static bool would_block() { return errno == EAGAIN || errno == EWOULDBLOCK; }
+
+int sock_set_nonblocking(int fd) {
+  int fl = ::fcntl(fd, F_GETFL, 0);
+  if (fl < 0) return -1;
+  return (fl & O_NONBLOCK) ? 0 : ::fcntl(fd, F_SETFL, fl | O_NONBLOCK);
+}
+
+int sock_accept(int fd, sockaddr* addr, socklen_t* addrlen) {
+  for (;;) {
+#if defined(__linux__)
+    int c = ::accept4(fd, addr, addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+    int c = ::accept(fd, addr, addrlen);
+    if (c >= 0) sock_set_nonblocking(c);
+#endif
+    if (c >= 0 || !would_block()) return c;
+    if (wait_fd(fd, POLLIN) < 0) return -1;
+  }
+}
+
+int sock_connect(int fd, const sockaddr* addr, socklen_t addrlen) {
+  if (sock_set_nonblocking(fd) < 0) return -1;
+  if (::connect(fd, addr, addrlen) == 0) return 0;
+  if (errno != EINPROGRESS && !would_block()) return -1;
+  if (wait_fd(fd, POLLOUT) < 0) return -1;
+  int err = 0;
+  socklen_t len = sizeof(err);
+  if (::getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) return -1;
+  if (err) { errno = err; return -1; }
+  return 0;
+}
+
+// MSG_DONTWAIT makes the call non-blocking even on a blocking fd.
+int64_t sock_read(int fd, void* buf, std::size_t len) {
+  for (;;) {
+    ssize_t n = ::recv(fd, buf, len, MSG_DONTWAIT);
+    if (n >= 0 || !would_block()) return n;
+    if (wait_fd(fd, POLLIN) < 0) return -1;
+  }
+}
+
+int64_t sock_write(int fd, const void* buf, std::size_t len) {
+  for (;;) {
+    ssize_t n = ::send(fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n >= 0 || !would_block()) return n;
+    if (wait_fd(fd, POLLOUT) < 0) return -1;
+  }
+}
+
+static int listen_on(int fd, const sockaddr* addr, socklen_t len, int backlog) {
+  if (::bind(fd, addr, len) < 0 || ::listen(fd, backlog) < 0 || sock_set_nonblocking(fd) < 0) {
+    int e = errno; ::close(fd); errno = e;
+    return -1;
+  }
+  return fd;
+}
+
+static bool make_inet(const char* host, int port, sockaddr_in& sa) {
+  sa = {};
+  sa.sin_family = AF_INET;
+  sa.sin_port   = htons((uint16_t)port);
+  if (::inet_pton(AF_INET, host, &sa.sin_addr) != 1) { errno = EINVAL; return false; }
+  return true;
+}
+
+static bool make_unix(const char* path, sockaddr_un& sa) {
+  sa = {};
+  sa.sun_family = AF_UNIX;
+  if (std::strlen(path) >= sizeof(sa.sun_path)) { errno = ENAMETOOLONG; return false; }
+  std::strcpy(sa.sun_path, path);
+  return true;
+}
+
+int sock_listen_tcp(const char* host, int port, int backlog) {
+  sockaddr_in sa;
+  if (!make_inet(host, port, sa)) return -1;
+  int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  int one = 1;
+  ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  return listen_on(fd, (sockaddr*)&sa, sizeof(sa), backlog);
+}
+
+int sock_listen_unix(const char* path, int backlog) {
+  sockaddr_un sa;
+  if (!make_unix(path, sa)) return -1;
+  int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  ::unlink(path);
+  return listen_on(fd, (sockaddr*)&sa, sizeof(sa), backlog);
+}
+
+int sock_connect_tcp(const char* host, int port) {
+  sockaddr_in sa;
+  if (!make_inet(host, port, sa)) return -1;
+  int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  if (sock_connect(fd, (sockaddr*)&sa, sizeof(sa)) < 0) { int e = errno; ::close(fd); errno = e; return -1; }
+  return fd;
+}
+
+int sock_connect_unix(const char* path) {
+  sockaddr_un sa;
+  if (!make_unix(path, sa)) return -1;
+  int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  if (sock_connect(fd, (sockaddr*)&sa, sizeof(sa)) < 0) { int e = errno; ::close(fd); errno = e; return -1; }
+  return fd;
+}
+
+int sock_local_port(int fd) {
+  sockaddr_in sa{};
+  socklen_t len = sizeof(sa);
+  if (::getsockname(fd, (sockaddr*)&sa, &len) < 0 || sa.sin_family != AF_INET) return -1;
+  return ntohs(sa.sin_port);
+}
+
+#endif // !_WIN32
+
 // -------------------------- Platform-specific glue --------------------------
 
+// Make tid the running thread; the caller then switches to its context.
+static void enter_thread(int tid) {
+  auto& r = rt();
+  auto& th = r.threads[tid];
+  r.current = tid;
+  r.threads.state(tid) = ThreadState::RUNNING;
+  r.sched.on_dispatch(r.threads, tid);
+  r.log.log("run", tid, th.name);
+}
+
+// A stackless task has no context to switch out of; it must use the co_await
+// forms instead of the blocking thread_* calls.
+static void check_stackful() {
+  auto& r = rt();
+  int tid = r.current;
+  if (tid >= 0 && r.threads[tid].coro_root) {
+    std::fprintf(stderr, "task '%s' called a blocking thread_* function; use co_await\n",
+                 r.threads[tid].name.c_str());
+    std::exit(1);
+  }
+}
+
 #if defined(_WIN32)
 
 static void ensure_main_fiber() {
-  if (!g_mainFiber) {
-    g_mainFiber = ConvertThreadToFiber(nullptr);
-    if (!g_mainFiber) {
+  auto& r = rt();
+  if (!r.main_fiber) {
+    r.main_fiber = ConvertThreadToFiber(nullptr);
+    if (!r.main_fiber) {
       std::fprintf(stderr, "ConvertThreadToFiber failed (%lu)\n", GetLastError());
       std::exit(1);
     }
@@ -345,84 +2047,96 @@ static void ensure_main_fiber() {
 }
 
 static VOID __stdcall fiber_trampoline(void* param) {
+  auto& r = rt();
   int tid = (int)(intptr_t)param;
-  g_current.store(tid);
-  auto& th = g_threads[tid];
-  th.state = ThreadState::RUNNING;
-  g_log.log("start", tid, th.name);
-  th.quantum_budget = (g_sched.policy == SchedPolicy::MLFQ)
-                        ? g_sched.quantum_by_level[th.mlfq_level] : std::max(1, th.quantum_budget);
+  r.current = tid;
+  auto& th = r.threads[tid];
+  r.threads.state(tid) = ThreadState::RUNNING;
+  r.log.log("start", tid, th.name);
+  th.quantum_budget = std::max(1, th.quantum_budget); // refilled by on_dispatch
 
-  th.func();
+  run_callable(th);
 
-  th.state = ThreadState::FINISHED;
-  g_log.log("finish", tid);
-  platform_yield_to_scheduler();
+  finish_thread(tid);
+  switch_out();
 }
 
-static void switch_to_thread(int next_tid) {
-  ensure_main_fiber();
-  auto& th = g_threads[next_tid];
+static void ensure_fiber(int tid) {
+  auto& th = rt().threads[tid];
   if (!th.cx.fiber) {
-    th.cx.fiber = CreateFiber(0, fiber_trampoline, (void*)(intptr_t)next_tid);
+    th.cx.fiber = CreateFiber(0, fiber_trampoline, (void*)(intptr_t)tid);
     if (!th.cx.fiber) {
       std::fprintf(stderr, "CreateFiber failed (%lu)\n", GetLastError());
       std::exit(1);
     }
   }
-  g_current.store(next_tid);
-  th.state = ThreadState::RUNNING;
-  if (g_sched.policy == SchedPolicy::MLFQ) th.quantum_budget = g_sched.quantum_by_level[th.mlfq_level];
-  g_log.log("run", next_tid, th.name);
-  SwitchToFiber(th.cx.fiber);
 }
 
-static void platform_yield_to_scheduler() {
+static void switch_to_thread(int next_tid) {
+  ensure_main_fiber();
+  ensure_fiber(next_tid);
+  enter_thread(next_tid);
+  SwitchToFiber(rt().threads[next_tid].cx.fiber);
+}
+
+// From one green thread straight into another, bypassing the scheduler.
+static void switch_between(int from, int to) {
+  (void)from;
+  ensure_fiber(to);
+  SwitchToFiber(rt().threads[to].cx.fiber);
+}
+
+static void switch_to_scheduler() {
   ensure_main_fiber();
-  SwitchToFiber(g_mainFiber);
+  SwitchToFiber(rt().main_fiber);
 }
 
 #else
 
 static void context_trampoline(int tid_int) {
+  auto& r = rt();
   int tid = tid_int;
-  g_current.store(tid);
-  auto& th = g_threads[tid];
-  th.state = ThreadState::RUNNING;
-  g_log.log("start", tid, th.name);
-  th.quantum_budget = (g_sched.policy == SchedPolicy::MLFQ)
-                        ? g_sched.quantum_by_level[th.mlfq_level] : std::max(1, th.quantum_budget);
+  r.current = tid;
+  auto& th = r.threads[tid];
+  r.threads.state(tid) = ThreadState::RUNNING;
+  r.log.log("start", tid, th.name);
+  th.quantum_budget = std::max(1, th.quantum_budget); // refilled by on_dispatch
 
-  th.func();
+  run_callable(th);
 
-  th.state = ThreadState::FINISHED;
-  g_log.log("finish", tid);
-  platform_yield_to_scheduler();
+  finish_thread(tid);
+  switch_out();
 }
 
 static void ensure_context(int tid) {
-  auto& th = g_threads[tid];
-  if (th.state == ThreadState::NEW) {
+  auto& th = rt().threads[tid];
+  if (!th.cx.made) {
+    th.cx.made = true;
     getcontext(&th.cx.ctx);
-    th.cx.ctx.uc_stack.ss_sp   = th.cx.stack.get();
-    th.cx.ctx.uc_stack.ss_size = STACK_SIZE;
-    th.cx.ctx.uc_link          = &g_sched_ctx;
+    th.cx.ctx.uc_stack.ss_sp   = th.cx.stack;
+    th.cx.ctx.uc_stack.ss_size = th.cx.usable;
+    th.cx.ctx.uc_link          = &rt().sched_ctx;
     makecontext(&th.cx.ctx, (void (*)())context_trampoline, 1, tid);
   }
 }
 
 static void switch_to_thread(int next_tid) {
+  auto& r = rt();
   ensure_context(next_tid);
-  g_current.store(next_tid);
-  auto& th = g_threads[next_tid];
-  th.state = ThreadState::RUNNING;
-  if (g_sched.policy == SchedPolicy::MLFQ) th.quantum_budget = g_sched.quantum_by_level[th.mlfq_level];
-  g_log.log("run", next_tid, th.name);
-  swapcontext(&g_sched_ctx, &th.cx.ctx);
+  enter_thread(next_tid);
+  swapcontext(&r.sched_ctx, &r.threads[next_tid].cx.ctx);
+}
+
+// From one green thread straight into another, bypassing the scheduler.
+static void switch_between(int from, int to) {
+  auto& r = rt();
+  ensure_context(to);
+  swapcontext(&r.threads[from].cx.ctx, &r.threads[to].cx.ctx);
 }
 
-static void platform_yield_to_scheduler() {
-  swapcontext(&g_threads[g_current.load()].cx.ctx, &g_sched_ctx);
+static void switch_to_scheduler() {
+  auto& r = rt();
+  swapcontext(&r.threads[r.current].cx.ctx, &r.sched_ctx);
 }
 
 #endif
@@ -430,89 +2144,422 @@ static void platform_yield_to_scheduler() {
 // ------------------------------ Scheduling loop -----------------------------
 
 static bool all_done() {
-  for (auto& th : g_threads) if (th.state != ThreadState::FINISHED) return false;
-  return true;
+  return rt().live == 0;
 }
 
 static void wake_sleepers() {
+  auto& r = rt();
   int64_t t = now_ms();
-  for (auto& th : g_threads) {
-    if (th.state == ThreadState::SLEEPING && th.wake_time_ms <= t) {
-      th.state = ThreadState::READY;
-      g_sched.enqueue(g_threads, th.tid);
-      g_log.log("wakeup", th.tid);
+  if (t < r.next_wake) return;
+  auto& due = r.scan_out;
+  due.clear();
+  r.next_wake = scan_due(r.threads.states(), r.threads.wake_times(), (int)r.threads.size(), t, due);
+  for (int tid : due) {
+    r.threads.state(tid) = ThreadState::READY;
+    r.sched.on_wakeup(r.threads[tid], r.threads.wake_time(tid));
+    r.sched.enqueue(r.threads, tid);
+    r.log.log("wakeup", tid);
+  }
+}
+
+// Submit prepared SQEs and reap CQEs once per scheduling pass: when the run
+// queue drains, or after as many dispatches as there were ready threads at the
+// previous flush.
+static void io_pass() {
+  auto& r = rt();
+#if defined(__linux__)
+  if (!r.io.ok() || (!r.io.pending && !r.io.inflight)) return;
+  if (!r.sched.empty() && r.io.pass_left > 0) { --r.io.pass_left; return; }
+  r.io.submit();
+  r.io.reap(io_complete);
+  r.io.pass_left = r.sched.size();
+#endif
+}
+
+// Something the loop would act on: a due sleeper, an I/O completion or a
+// cross-thread notification.
+static bool idle_has_work(Runtime::Impl& r) {
+  if (r.inbox.pending.load(std::memory_order_acquire)) return true;
+  if (r.next_wake != INT64_MAX && now_ms() >= r.next_wake) return true;
+#if defined(__linux__)
+  if (r.io.ok() && r.io.cq_ready()) return true;
+#endif
+  return false;
+}
+
+// Nothing runnable: poll for idle_spin_us, then sched_yield for
+// idle_yield_us, then sleep until the earliest of the next sleeper deadline,
+// an I/O completion or a cross-thread notification.
+static void idle_wait() {
+  auto& r = rt();
+  if (r.new_pending > 0) return; // spawned by the last thread to run
+  if (r.picked >= 0) return;     // a task taken off the queue by switch_out
+#if defined(__linux__)
+  if (r.io.ok()) r.io.submit();
+#endif
+  if (r.idle_spin_us > 0 || r.idle_yield_us > 0) {
+    int64_t start = now_ms();
+    int64_t spin_end = start + r.idle_spin_us;
+    int64_t yield_end = spin_end + r.idle_yield_us;
+    for (int64_t t = start; t < yield_end; t = now_ms()) {
+      if (idle_has_work(r)) {
+        ++(t < spin_end ? r.idle.spin : r.idle.yield);
+        return;
+      }
+      if (t >= spin_end) std::this_thread::yield();
     }
   }
+  ++r.idle.park;
+  int64_t deadline = r.next_wake == INT64_MAX ? -1 : r.next_wake;
+#if defined(__linux__)
+  if (r.waiter.init()) {
+    r.waiter.wait(r.io, deadline);
+    return;
+  }
+#endif
+  std::this_thread::sleep_for(Ms(1));
 }
 
-static void schedule_once() {
+void idle_set_strategy(int spin_us, int yield_us) {
+  auto& r = rt();
+  r.idle_spin_us  = std::max(0, spin_us);
+  r.idle_yield_us = std::max(0, yield_us);
+}
+
+IdleStats idle_stats() { return rt().idle; }
+
+// ------------------------------ Memory accounting ---------------------------
+
+// Heap bytes behind a string (0 while it fits the small-string buffer).
+static size_t heap_bytes(const std::string& s) {
+  const char* p = s.data();
+  bool inline_buf = p >= (const char*)&s && p < (const char*)(&s + 1);
+  return inline_buf ? 0 : s.capacity() + 1;
+}
+
+// Estimated size of one node-based container entry: the value plus links.
+template <class Map>
+static size_t entry_bytes(const Map&) {
+  return sizeof(typename Map::value_type) + 2 * sizeof(void*);
+}
+
+static size_t tls_bytes(const Runtime::Impl& r, int tid, const std::vector<LocalValue>& locals) {
+  size_t n = locals.capacity() * sizeof(LocalValue);
+  for (auto& l : locals) if (l.obj) n += l.size;
+  auto it = r.tls.find(tid);
+  if (it != r.tls.end()) {
+    n += entry_bytes(r.tls) + it->second.bucket_count() * sizeof(void*);
+    for (auto& [key, value] : it->second) n += entry_bytes(it->second) + heap_bytes(key);
+  }
+  return n;
+}
+
+static size_t stack_reserved(const Thread& th) {
+#if defined(_WIN32)
+  (void)th;
+  return 0; // fiber stacks belong to the OS
+#else
+  return th.cx.stack ? STACK_SIZE : 0;
+#endif
+}
+
+// Resident pages of the stack, whole pages inside it only.
+static size_t stack_touched(const Thread& th) {
+#if defined(__linux__)
+  if (!th.cx.stack) return 0;
+  const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+  uintptr_t lo = ((uintptr_t)th.cx.stack + page - 1) & ~(page - 1);
+  uintptr_t hi = ((uintptr_t)th.cx.stack + STACK_SIZE) & ~(page - 1);
+  if (hi <= lo) return 0;
+  unsigned char vec[STACK_SIZE / 4096];
+  if (mincore((void*)lo, hi - lo, vec) != 0) return 0;
+  size_t n = 0;
+  for (size_t i = 0; i < (hi - lo) / page; ++i) n += vec[i] & 1;
+  return n * page;
+#else
+  (void)th;
+  return 0;
+#endif
+}
+
+static const char* state_name(ThreadState s) {
+  switch (s) {
+    case ThreadState::NEW:      return "new";
+    case ThreadState::READY:    return "ready";
+    case ThreadState::RUNNING:  return "running";
+    case ThreadState::BLOCKED:  return "blocked";
+    case ThreadState::SLEEPING: return "sleeping";
+    case ThreadState::FINISHED: return "finished";
+  }
+  return "?";
+}
+
+MemoryStats memory_stats() {
+  auto& r = rt();
+  MemoryStats m;
+  m.records = r.threads.record_bytes();
+  m.stacks  = r.threads.stack_bytes();
+  for (auto& th : r.threads) {
+    size_t touched = stack_touched(th);
+    m.stacks_touched += touched;
+    if (r.threads.state(th.tid) == ThreadState::FINISHED) continue;
+    ThreadMemory t;
+    t.tid  = th.tid;
+    t.name = th.name;
+    t.stack_reserved = stack_reserved(th);
+    t.stack_touched  = touched;
+    t.tls      = tls_bytes(r, th.tid, th.locals);
+    t.callable = th.fn_obj ? th.fn_size : 0;
+    t.arena    = th.arena.reserved;
+    m.tls    += t.tls;
+    m.arenas += t.arena;
+    if (th.fn_heap_align) m.callables += t.callable;
+    m.threads.push_back(std::move(t));
+  }
+  m.tls    += tls_bytes(r, -1, r.main_locals);
+  m.arenas += r.main_arena.reserved;
+  m.run_queues = r.sched.queue_bytes();
+  for (auto& [name, wq] : r.resources) {
+    m.wait_queues += entry_bytes(r.resources) + heap_bytes(name) + wq.q.size() * sizeof(int);
+  }
+  if (r.log.out.is_open()) {
+    auto pos = r.log.out.tellp();
+    if (pos > 0) m.log_written = (size_t)pos;
+  }
+  return m;
+}
+
+void runtime_dump(std::ostream& out) {
+  auto& r = rt();
+  MemoryStats m = memory_stats();
+  char line[256];
+  std::snprintf(line, sizeof line, "runtime: policy %s, %d live of %zu threads, %zu ready\n",
+                policy_name(r.sched.policy), r.live, r.threads.size(), r.sched.size());
+  out << line;
+  out << "  tid  state     prio  stack touched/reserved       tls  callable     arena  name\n";
+  for (auto& t : m.threads) {
+    const Thread& th = r.threads[t.tid];
+    std::snprintf(line, sizeof line, "%5d  %-8s  %2d/%-2d  %10zu/%-10zu %9zu %9zu %9zu  %s\n", t.tid,
+                  state_name(r.threads.state(t.tid)), th.base_priority,
+                  r.sched.current_dyn_priority(r.threads, t.tid),
+                  t.stack_touched, t.stack_reserved, t.tls, t.callable, t.arena, t.name.c_str());
+    out << line;
+  }
+  std::snprintf(line, sizeof line,
+                "memory: %zu total = records %zu + stacks %zu (%zu touched) + tls %zu + callables %zu"
+                " + arenas %zu + run queues %zu + wait queues %zu; log written %zu\n",
+                m.total(), m.records, m.stacks, m.stacks_touched, m.tls, m.callables, m.arenas,
+                m.run_queues, m.wait_queues, m.log_written);
+  out << line;
+}
+
+// ------------------------------ Stackless tasks -----------------------------
+
+// Tasks run on the scheduler's stack until their next co_await suspends them.
+static void run_task(int tid) {
+  auto& r = rt();
+  auto& th = r.threads[tid];
+  r.current = tid;
+  r.threads.state(tid) = ThreadState::RUNNING;
+  r.sched.on_dispatch(r.threads, tid);
+  r.log.log("run", tid, th.name);
+  th.coro.resume();
+  if (th.coro_root.done()) {
+    th.coro_root.destroy();
+    th.coro_root = th.coro = nullptr;
+    finish_thread(tid);
+  }
+}
+
+static void dispatch(int tid) {
+  if (rt().threads[tid].coro_root) run_task(tid);
+  else switch_to_thread(tid);
+}
+
+namespace detail {
+int current_tid() { return rt().current; }
+
+int task_register(std::coroutine_handle<> h, const std::string& name, int priority) {
+  Thread& t = add_thread(name, priority);
+  t.coro_root = t.coro = h;
+  return t.tid;
+}
+
+void task_sleep(std::coroutine_handle<> h, int ms) {
+  int tid = rt().current;
+  rt().threads[tid].coro = h;
+  begin_sleep(tid, ms);
+}
+
+void task_wait(std::coroutine_handle<> h, const std::string& resource) {
+  int tid = rt().current;
+  rt().threads[tid].coro = h;
+  begin_wait(tid, resource);
+}
+
+void task_yield(std::coroutine_handle<> h) {
+  int tid = rt().current;
+  rt().threads[tid].coro = h;
+  begin_yield(tid);
+}
+
+void task_block(std::coroutine_handle<> h) {
+  auto& r = rt();
+  int tid = r.current;
+  r.threads[tid].coro = h;
+  r.threads.state(tid) = ThreadState::BLOCKED;
+  r.threads[tid].block = BlockKind::Park;
+}
+
+bool block_current(bool cancellable) {
+  if (rt().current < 0) {
+    std::fprintf(stderr, "blocking call outside a green thread (no thread to park)\n");
+    std::exit(1);
+  }
+  if (cancellable && cancelled_now()) return false;
+  park_blocked(rt().current, cancellable ? BlockKind::Park : BlockKind::Uncancellable, []{});
+  return !cancelled_now();
+}
+
+void wake(int tid) {
+  if (rt().threads.state(tid) != ThreadState::BLOCKED) return;
+  make_ready(tid, "wake");
+}
+} // namespace detail
+
+// Everything a pass does before picking a thread: admit NEW threads, wake
+// sleepers, apply cross-thread notifications and I/O completions.
+static void poll_ready() {
+  auto& r = rt();
   // Move NEW to READY
-  for (auto& th : g_threads) {
-    if (th.state == ThreadState::NEW) {
-      th.state = ThreadState::READY;
-      g_sched.enqueue(g_threads, th.tid);
-      g_log.log("ready", th.tid);
+  if (r.new_pending > 0) {
+    auto& fresh = r.scan_out;
+    fresh.clear();
+    scan_state(r.threads.states(), (int)r.threads.size(), ThreadState::NEW, fresh);
+    for (int tid : fresh) {
+      r.threads.state(tid) = ThreadState::READY;
+      r.sched.enqueue(r.threads, tid);
+      r.log.log("ready", tid);
     }
+    r.new_pending = 0;
   }
 
   wake_sleepers();
-  g_sched.maybe_age(g_threads);
+  drain_inbox();
+  io_pass();
+  r.sched.on_pass(r.threads, r.log);
+}
 
-  if (g_sched.empty()) return;
+// Next tid to dispatch, or -1 if nothing is runnable.
+static int take_next() {
+  auto& r = rt();
+  if (r.picked >= 0) return std::exchange(r.picked, -1);
+  if (r.handoff >= 0) {
+    int t = std::exchange(r.handoff, -1);
+    if (r.threads.state(t) == ThreadState::READY) {
+      r.sched.take(r.threads, t);
+      return t;
+    }
+  }
+  if (r.sched.empty()) return -1;
+  return r.sched.pop(r.threads);
+}
+
+static void schedule_once() {
+  poll_ready();
+  int next = take_next();
+  if (next >= 0) dispatch(next);
+}
 
-  int next = g_sched.pop(g_threads);
-  if (next >= 0) {
-    switch_to_thread(next);
+// Leaving a green thread (yield, block, finish) runs the pass on its own
+// stack and switches straight into the next green thread: one context switch
+// instead of two through the loop. The loop's context is entered only when
+// nothing is runnable (to idle) or the next tid is a task, which runs on the
+// loop's stack.
+static void switch_out() {
+  auto& r = rt();
+  check_stackful();
+  int cur = r.current;
+  poll_ready();
+  int next = take_next();
+  if (next == cur) {
+    enter_thread(cur);
+    return;
   }
+  if (next >= 0 && !r.threads[next].coro_root) {
+    enter_thread(next);
+    switch_between(cur, next);
+    return;
+  }
+  r.picked = next;
+  switch_to_scheduler();
 }
 
 void thread_yield() {
-  int tid = g_current.load();
-  if (tid >= 0) {
-    auto& th = g_threads[tid];
-    if (th.state == ThreadState::RUNNING) {
-      th.state = ThreadState::READY;
-      g_sched.enqueue(g_threads, tid);
-      g_log.log("yield", tid);
-    }
+  int tid = rt().current;
+  if (tid >= 0) begin_yield(tid);
+  switch_out();
+}
+
+// The target is taken out of the run queue (Scheduler::take). A stackless
+// target cannot be switched into from a thread stack; it is handed to the
+// scheduler to run next instead.
+bool thread_yield_to(int tid) {
+  auto& r = rt();
+  int cur = r.current;
+  if (cur < 0 || tid == cur || tid < 0 || tid >= (int)r.threads.size()) return false;
+  check_stackful();
+  auto& th = r.threads[tid];
+  ThreadState st = r.threads.state(tid);
+  if (st != ThreadState::READY && st != ThreadState::NEW) return false;
+  r.log.log("yieldto", cur, std::to_string(tid));
+  if (th.coro_root) {
+    r.handoff = tid;
+    thread_yield();
+    return true;
   }
-  platform_yield_to_scheduler();
+  if (st == ThreadState::READY) r.sched.take(r.threads, tid);
+  begin_yield(cur);
+  enter_thread(tid);
+  switch_between(cur, tid);
+  return true;
 }
 
 void thread_run() {
-  g_sched.set_policy_from_env();
+  auto& r = rt();
+  r.sched.set_policy_from_env(r.threads);
 #if defined(_WIN32)
-  if (!g_mainFiber) {
-    g_mainFiber = ConvertThreadToFiber(nullptr);
-    if (!g_mainFiber) {
+  if (!r.main_fiber) {
+    r.main_fiber = ConvertThreadToFiber(nullptr);
+    if (!r.main_fiber) {
       std::fprintf(stderr, "ConvertThreadToFiber failed (%lu)\n", GetLastError());
       std::exit(1);
     }
   }
 #else
-  // Prepare scheduler context
-  getcontext(&g_sched_ctx);
-  static char sched_stack[STACK_SIZE];
-  g_sched_ctx.uc_stack.ss_sp   = sched_stack;
-  g_sched_ctx.uc_stack.ss_size = sizeof(sched_stack);
-  g_sched_ctx.uc_link          = nullptr;
+  // Prepare scheduler context (swapcontext saves the loop's own stack here)
+  getcontext(&r.sched_ctx);
+#endif
+
+#if defined(__linux__)
+  r.waiter.init();
 #endif
 
-  g_log.log("boot", -1, (g_sched.policy==SchedPolicy::RoundRobin?"rr":(g_sched.policy==SchedPolicy::Priority?"prio":"mlfq")));
+  r.log.log("boot", -1, policy_name(r.sched.policy));
 
   while (!all_done()) {
     schedule_once();
-    if (g_sched.empty()) {
-      // idle
-      std::this_thread::sleep_for(Ms(1));
+    if (r.picked < 0 && r.sched.empty() && !all_done()) {
+      idle_wait();
     }
   }
 
-  g_log.log("halt", -1);
+  r.log.log("halt", -1);
+  r.current = -1; // back in the main context (TLS, cancellation checks)
 
 #if defined(_WIN32)
   ConvertFiberToThread();
-  g_mainFiber = nullptr;
+  r.main_fiber = nullptr;
 #endif
 }
 